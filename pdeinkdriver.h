@@ -15,6 +15,12 @@
 #include <wchar.h>
 
 #include "src/EInk44.h"
+#include "src/EInkDitherer.h"
+#include "src/EInkFont.h"
+#include "src/EInkImageLoader.h"
+#include "src/EInkTiledCanvas.h"
+#include "src/VirtualCanvas.h"
+#include "src/RealTime.h"
 
 namespace PDEInkDriver {
 
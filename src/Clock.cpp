@@ -0,0 +1,106 @@
+
+#include <errno.h>
+
+#include "Clock.h"
+
+namespace PDEInkDriver {
+
+Clock::~Clock(){
+}
+
+bool Clock::isReal(){
+	return false;
+}
+
+Clock* Clock::monotonic(){
+	static MonotonicClock clock;
+	return &clock;
+}
+
+MonotonicClock::MonotonicClock(){
+	#ifdef CLOCK_MONOTONIC_RAW
+	struct timespec ts;
+	_id = (clock_gettime(CLOCK_MONOTONIC_RAW, &ts) == 0) ? CLOCK_MONOTONIC_RAW : CLOCK_MONOTONIC;
+	#else
+	_id = CLOCK_MONOTONIC;
+	#endif
+}
+
+uint64_t MonotonicClock::now(){
+	struct timespec ts;
+	clock_gettime(_id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool MonotonicClock::isReal(){
+	return true;
+}
+
+void MonotonicClock::sleep(uint64_t us){
+	struct timespec ts;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	while(nanosleep(&ts, &ts) != 0 && EINTR == errno){
+		// interrupted, sleep the remainder
+	}
+}
+
+VirtualClock::VirtualClock(uint64_t start){
+	_now = start;
+	_slept = 0;
+}
+
+uint64_t VirtualClock::now(){
+	return _now;
+}
+
+void VirtualClock::sleep(uint64_t us){
+	_now += us;
+	_slept += us;
+}
+
+void VirtualClock::advance(uint64_t us){
+	_now += us;
+}
+
+void VirtualClock::set(uint64_t us){
+	_now = us;
+}
+
+uint64_t VirtualClock::slept(){
+	return _slept;
+}
+
+Deadline::Deadline(){
+	_clock = NULL;
+	_start = 0;
+	_at = 0;
+}
+
+Deadline::Deadline(Clock* clock, uint64_t timeout){
+	_clock = clock;
+	reset(timeout);
+}
+
+void Deadline::reset(uint64_t timeout){
+	_start = _clock->now();
+	_at = _start + timeout;
+}
+
+bool Deadline::expired(){
+	return NULL == _clock || _clock->now() >= _at;
+}
+
+uint64_t Deadline::elapsed(){
+	return (NULL == _clock) ? 0 : _clock->now() - _start;
+}
+
+uint64_t Deadline::remaining(){
+	if(NULL == _clock){
+		return 0;
+	}
+	uint64_t now = _clock->now();
+	return (now >= _at) ? 0 : _at - now;
+}
+
+}
@@ -0,0 +1,86 @@
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace PDEInkDriver {
+
+// Source of monotonic time in microseconds. The driver only ever asks a
+// Clock for the time or to sleep, so a VirtualClock can stand in for the
+// real one and run timing sequences without waiting for them.
+class Clock {
+
+public:
+	virtual ~Clock();
+
+	virtual uint64_t now() = 0;
+	virtual void sleep(uint64_t us) = 0;
+
+	// true when time passes on its own, so it can be spun and polled on
+	virtual bool isReal();
+
+	// shared MonotonicClock used when nothing else is set
+	static Clock* monotonic();
+};
+
+// CLOCK_MONOTONIC_RAW where available, so NTP slewing never moves it
+class MonotonicClock : public Clock {
+
+public:
+	MonotonicClock();
+
+	uint64_t now();
+	void sleep(uint64_t us);
+	bool isReal();
+
+private:
+	clockid_t _id;
+};
+
+// Time only moves when slept on or advanced by hand
+class VirtualClock : public Clock {
+
+public:
+	VirtualClock(uint64_t start = 0);
+
+	uint64_t now();
+	void sleep(uint64_t us);
+
+	void advance(uint64_t us);
+	void set(uint64_t us);
+
+	// total time spent sleeping
+	uint64_t slept();
+
+private:
+	uint64_t _now;
+	uint64_t _slept;
+};
+
+// A timeout measured on a Clock. A default constructed deadline has
+// already expired.
+class Deadline {
+
+public:
+	Deadline();
+	Deadline(Clock* clock, uint64_t timeout);
+
+	void reset(uint64_t timeout);
+
+	bool expired();
+	uint64_t elapsed();
+	uint64_t remaining();
+
+private:
+	Clock* _clock;
+	uint64_t _start;
+	uint64_t _at;
+};
+
+}
+
+#endif
@@ -0,0 +1,76 @@
+
+#include <string.h>
+
+#include "ContentHash.h"
+
+namespace PDEInkDriver {
+
+static const uint32_t PRIME1 = 2654435761U;
+static const uint32_t PRIME2 = 2246822519U;
+static const uint32_t PRIME3 = 3266489917U;
+static const uint32_t PRIME4 = 668265263U;
+static const uint32_t PRIME5 = 374761393U;
+
+static inline uint32_t rotl(uint32_t v, int r){
+	return (v << r) | (v >> (32 - r));
+}
+
+static inline uint32_t read32(const unsigned char* p){
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+	#endif
+	return v;
+}
+
+static inline uint32_t xxh_round(uint32_t acc, uint32_t input){
+	acc += input * PRIME2;
+	acc = rotl(acc, 13);
+	return acc * PRIME1;
+}
+
+uint32_t contentHash(const void* data, size_t length, uint32_t seed){
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* end = p + length;
+	uint32_t h;
+
+	if(length >= 16){
+		uint32_t v1 = seed + PRIME1 + PRIME2;
+		uint32_t v2 = seed + PRIME2;
+		uint32_t v3 = seed;
+		uint32_t v4 = seed - PRIME1;
+		const unsigned char* limit = end - 16;
+		do {
+			v1 = xxh_round(v1, read32(p));
+			v2 = xxh_round(v2, read32(p + 4));
+			v3 = xxh_round(v3, read32(p + 8));
+			v4 = xxh_round(v4, read32(p + 12));
+			p += 16;
+		} while(p <= limit);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+	} else {
+		h = seed + PRIME5;
+	}
+	h += (uint32_t)length;
+
+	while(p + 4 <= end){
+		h += read32(p) * PRIME3;
+		h = rotl(h, 17) * PRIME4;
+		p += 4;
+	}
+	while(p < end){
+		h += (*p) * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+		p++;
+	}
+
+	h ^= h >> 15;
+	h *= PRIME2;
+	h ^= h >> 13;
+	h *= PRIME3;
+	h ^= h >> 16;
+	return h;
+}
+
+}
@@ -0,0 +1,16 @@
+
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PDEInkDriver {
+
+// 32 bit xxHash of a buffer. Four independent lanes keep the pipeline
+// busy, so hashing a full frame costs far less than sending it.
+uint32_t contentHash(const void* data, size_t length, uint32_t seed = 0);
+
+}
+
+#endif
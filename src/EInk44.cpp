@@ -2,42 +2,136 @@
 
 #include "EInk44.h"
 
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
 #define DEBUG false
 namespace PDEInkDriver {
 
-EInk44::EInk44(GPIO::GPIO_pin_type en, GPIO::GPIO_pin_type cs, GPIO::GPIO_pin_type busy){
+// Clock rates tried by the probe and stepped through on errors
+static const uint32_t spi_speeds[] = {
+	1000000, 2000000, 4000000, 6000000, 8000000, 12000000, 16000000, 20000000, 24000000
+};
+static const int spi_speed_count = sizeof(spi_speeds) / sizeof(spi_speeds[0]);
+
+// Payload of the state file, the update policy state follows it and is
+// only written along with display updates
+struct EInkSavedState {
+	uint64_t lastUpdateTime;
+	uint32_t lastTransition;
+	uint32_t speed;
+	uint8_t powered;
+	uint8_t changed;
+	uint8_t shown;
+	uint8_t bandKnown[EINK_CONTENT_BANDS];
+	uint32_t bandHash[EINK_CONTENT_BANDS];
+	int32_t roiCount;
+	int32_t rois[EINK_CONTENT_MAX_ROIS][5];  // x, y, w, h, hash
+	EInkBusyModel::Estimate busy[EINK_BUSY_COMMANDS];
+};
+
+EInk44::EInk44(GPIO::GPIO_pin_type en, GPIO::GPIO_pin_type cs, GPIO::GPIO_pin_type busy, bool power, const char* spidev){
 
 	_en = en;
 	_cs = cs;
 	_busy = busy;
 
-	_spi = new SPI("/dev/spidev1.0", 8000000, _cs);
-	_hasBeenInited = false;
+	_clock = Clock::monotonic();
+	_epoll = -1;
+	_timer = -1;
+	_busyFd = -1;
+
+	// EN and CS are driven together during power up, so request all three
+	// lines in one go; the chardev backend then holds them in shared handles.
+	// A native CS is no GPIO and is left out.
+	int pins[3] = { _busy, _en, _cs };
+	GPIO::GPIO_mode_type modes[3] = { GPIO::GPIO_INPUT, GPIO::GPIO_OUTPUT, GPIO::GPIO_OUTPUT };
+	GPIO::GPIO_request(pins, modes, (_cs < 0) ? 2 : 3);
+
+	_spi = new SPI(spidev, DEFAULT_SPI_SPEED, _cs);
+	inout = _spi->txBuffer();
+	_status = _spi->rxBuffer();
+	memset(&_upload, 0, sizeof(_upload));
+	_upload.complete = true;
+	_uploadMode = EINK_UPLOAD_ACKNOWLEDGED;
+	_responses = 0;
+	_badResponses = 0;
+	_dedup = true;
+	memset(&_stats, 0, sizeof(_stats));
+	_policy = &_defaultPolicy;
+	_powered = false;
+	_lastTransition = EINK_UPDATE_FULL;
+	_lastUpdateTime = 0;
+	_timeoutRun = 0;
+	_errorRun = 0;
+	_failed = false;
+	_recovering = false;
+	memset(&_health, 0, sizeof(_health));
+	_frame = new EInkImage(EINK_WIDTH, EINK_HEIGHT);
+	_frameValid = false;
+	_latency = NULL;
+	invalidateControllerState();
+	invalidateContent();
 	if (NULL == _spi) {
 		warn("SPI_setup failed");
-	} else {
-
-
-		GPIO::GPIO_mode(_busy, GPIO::GPIO_INPUT);
-		GPIO::GPIO_mode(_en, GPIO::GPIO_OUTPUT);
-		GPIO::GPIO_mode(_cs, GPIO::GPIO_OUTPUT);
-		usleep(5 * 000);
-
-		GPIO_write(_en, 1);
-		GPIO_write(_cs, 0);
-
-		usleep(5 * 1000);
+	} else if (power) {
+		EInk44* self = this;
+		powerSequence(&self, 1);
+	}
+}
 
-		GPIO_write(_en, 0);
-		GPIO_write(_cs, 0);
+// Drive every EN/CS pair in lines to the same levels with one write
+static void _writePowerLines(int* lines, int* values, int count, int en, int cs){
+	int i;
+	for(i = 0; i < count; i++){
+		values[2 * i] = en;
+		values[2 * i + 1] = cs;
+	}
+	GPIO::GPIO_write_many(lines, values, 2 * count);
+}
 
-		usleep(25 * 1000);
+// Run the power up sequence on several panels at once. Every step drives
+// the EN and CS lines of all panels together and the settle delays are
+// shared, so bringing up a wall costs the same 30ms as a single panel.
+// A native CS cannot be driven from here; it idles high, which is where
+// the sequence leaves it, and the GPIO layer ignores its negative pin.
+void EInk44::powerSequence(EInk44** panels, int count){
+	if(count <= 0){
+		return;
+	}
 
-		GPIO_write(_en, 0);
-		GPIO_write(_cs, 1);
+	int* lines = (int*)malloc(2 * count * sizeof(int));
+	int* values = (int*)malloc(2 * count * sizeof(int));
+	if(NULL == lines || NULL == values){
+		free(lines);
+		free(values);
+		return;
+	}
 
-		_spi->on();
+	int i;
+	for(i = 0; i < count; i++){
+		lines[2 * i] = panels[i]->_en;
+		lines[2 * i + 1] = panels[i]->_cs;
+	}
+	Clock* clock = panels[0]->_clock;
+
+	_writePowerLines(lines, values, count, 1, 0);
+	clock->sleep(5 * 1000);
+	_writePowerLines(lines, values, count, 0, 0);
+	clock->sleep(25 * 1000);
+	_writePowerLines(lines, values, count, 0, 1);
+
+	for(i = 0; i < count; i++){
+		panels[i]->invalidateControllerState();
+		panels[i]->_spi->on();
+		panels[i]->_powered = true;
+		panels[i]->_saveState();
 	}
+
+	free(lines);
+	free(values);
 }
 
 EInk44::~EInk44(){
@@ -45,20 +139,92 @@ EInk44::~EInk44(){
 		_spi->off();
 		delete _spi;
 	}
+	if(_timer >= 0){
+		close(_timer);
+	}
+	if(_epoll >= 0){
+		close(_epoll);
+	}
+	delete _frame;
 }
 
 void EInk44::enable(){
 	if(DEBUG) printf("[EINK] Enable\n");
 	GPIO::GPIO_write(_en, 0);
+	invalidateControllerState();
+	_powered = true;
+	_saveState();
 }
 
 void EInk44::disable(){
 	if(DEBUG) printf("[EINK] Disable\n");
 	GPIO::GPIO_write(_en, 1);
+	invalidateControllerState();
+	_powered = false;
+	_saveState();
+}
+
+void EInk44::setSpeed(uint32_t hz){
+	if(hz < MIN_SPI_SPEED){
+		hz = MIN_SPI_SPEED;
+	}
+	if(hz > MAX_SPI_SPEED){
+		hz = MAX_SPI_SPEED;
+	}
+	_spi->setSpeed(hz);
+	_responses = 0;
+	_badResponses = 0;
+	_saveState();
+}
+
+uint32_t EInk44::speed(){
+	return _spi->speed();
+}
+
+uint32_t EInk44::probeSpeed(uint32_t max){
+	if(!_checkHealth()){
+		return speed();
+	}
+	int clean = -1;
+	bool failed = false;
+	int i;
+	for(i = 0; i < spi_speed_count && spi_speeds[i] <= max; i++){
+		setSpeed(spi_speeds[i]);
+		int errors = _probeErrors(SPI_PROBE_PACKETS);
+		if(DEBUG) printf("[EINK] Probe %u Hz: %d errors\n", spi_speeds[i], errors);
+		if(errors > 0){
+			failed = true;
+			break;
+		}
+		clean = i;
+	}
+
+	// Stay a step below the fastest clean rate when errors showed where
+	// the limit is, cables warm up and age
+	int pick = clean;
+	if(failed && pick > 0){
+		pick--;
+	}
+	setSpeed(spi_speeds[(pick < 0) ? 0 : pick]);
+
+	// the probe pattern is in the image buffer now
+	invalidateContent();
+	invalidateControllerState();
+	_policy->noteUnknown(0, 0, EINK_WIDTH, EINK_HEIGHT);
+	return speed();
+}
+
+void EInk44::invalidateControllerState(){
+	_roiKnown = false;
+	_pointerAtStart = false;
+	_framePointer = false;
 }
 
 // Erase the EInk Screen
 void EInk44::erase(){
+	if(!_checkHealth()){
+		return;
+	}
 	if(DEBUG) printf("Erase display. ");
 	inout[0] = 0x20;
 	inout[1] = 0x0E;
@@ -72,92 +238,340 @@ void EInk44::erase(){
 	_spi->disable();
 	if(DEBUG) printf("\n");
 
-	_waitForBusy(MAX_TIMEOUT);
+	_waitForBusy(MAX_TIMEOUT, EINK_BUSY_ERASE);
+	invalidateContent();
+	invalidateControllerState();
+	_policy->noteUnknown(0, 0, EINK_WIDTH, EINK_HEIGHT);
 }
 
-void EInk44::update(){
-	_sendUpdate(0x24);
+void EInk44::update(bool force){
+	_sendUpdate(0x24, force);
 }
 
-void EInk44::updateFlashless(){
-	_sendUpdate(0x85);
+void EInk44::updateFlashless(bool force){
+	_sendUpdate(0x85, force);
 }
 
-void EInk44::updateFlashlessInverted(){
-	_sendUpdate(0x86);
+void EInk44::updateFlashlessInverted(bool force){
+	_sendUpdate(0x86, force);
 }
 
-void EInk44::sendImage(EInkImage& img){
-	sendImage(img.bits(), img.length(), DEFAULT_PACKET_LENGTH);
+void EInk44::updateAuto(bool force){
+	_sendUpdate(_policy->choose(), force);
 }
 
-void EInk44::sendImage(XBMImage& img){
-	sendImage(img.bits(), img.length(), DEFAULT_PACKET_LENGTH);	
+bool EInk44::refreshIfIdle(){
+	if(isBusy() || !_policy->idleRefreshDue(_clock->now())){
+		return false;
+	}
+	if(DEBUG) printf("[EINK] Idle refresh\n");
+	_sendUpdate(EINK_UPDATE_FULL, true);
+	return true;
 }
 
-bool EInk44::sendImage(unsigned char * buff, int length, unsigned char packetLength, int retrynum){
-	int i;
-	int packets = (length / packetLength) + 1;
-	int lastPacketLength = length % packetLength;
-	if(DEBUG) printf("Send image(%d, %d, %d, %d).\n", length, packetLength, packets, lastPacketLength);
+void EInk44::setUpdatePolicy(EInkUpdatePolicy* policy){
+	_policy = (NULL == policy) ? &_defaultPolicy : policy;
+}
+
+EInkUpdatePolicy* EInk44::updatePolicy(){
+	return _policy;
+}
+
+bool EInk44::sendImage(EInkImage& img){
+	return sendImage(img.bits(), img.length(), DEFAULT_PACKET_LENGTH);
+}
+
+bool EInk44::sendImage(XBMImage& img){
+	return sendImage(img.bits(), img.length(), DEFAULT_PACKET_LENGTH);
+}
+
+bool EInk44::sendImage(EInkFrameStore& store, int index){
+	unsigned char* frame = store.frame(index);
+	if(NULL == frame || store.width() != EINK_WIDTH || store.height() != EINK_HEIGHT){
+		if(DEBUG) printf("[EINK] [ERROR] No frame %d of panel size in store\n", index);
+		return false;
+	}
+	return sendImage(frame, store.frameLength(), DEFAULT_PACKET_LENGTH);
+}
+
+bool EInk44::sendImage(unsigned char * buff, int length, unsigned char packetLength){
+	if(!_checkHealth()){
+		return false;
+	}
+	if(DEBUG) printf("Send image(%d, %d).\n", length, packetLength);
 	if(DEBUG) printf("=================================\n");
 
-	_resetDataPointer();
+	_upload.data = buff;
+	_upload.length = length;
+	_upload.headerLength = 16;
+	_upload.stride = EINK_WIDTH / 8;
+	_upload.packetLength = packetLength;
+	_upload.x = 0;
+	_upload.y = 0;
+	_upload.w = EINK_WIDTH;
+	_upload.h = EINK_HEIGHT;
+	_upload.roi = false;
+
+	int rowBytes = EINK_WIDTH / 8;
+	bool frame = length == EINK_HEADER_LENGTH + EINK_HEIGHT * rowBytes;
+	if(!_dedup || !frame){
+		_forgetContent(0, 0, EINK_WIDTH, EINK_HEIGHT);
+		_stats.uploads++;
+		bool ok = _startUpload();
+		if(frame){
+			_policy->noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, buff + EINK_HEADER_LENGTH, rowBytes);
+		} else {
+			_policy->noteUnknown(0, 0, EINK_WIDTH, EINK_HEIGHT);
+		}
+		_saveState();
+		return ok;
+	}
+
+	// Hash the frame band by band and compare with what the controller has
+	uint32_t bands[EINK_CONTENT_BANDS];
+	int first = -1, last = -1;
+	int i;
+	for(i = 0; i < EINK_CONTENT_BANDS; i++){
+		int top = i * EINK_CONTENT_BAND_ROWS;
+		int rows = (top + EINK_CONTENT_BAND_ROWS > EINK_HEIGHT) ? EINK_HEIGHT - top : EINK_CONTENT_BAND_ROWS;
+		bands[i] = contentHash(buff + EINK_HEADER_LENGTH + top * rowBytes, rows * rowBytes);
+		if(!_bandKnown[i] || bands[i] != _bandHash[i]){
+			if(first < 0){
+				first = i;
+			}
+			last = i;
+		}
+	}
+
+	if(first < 0){
+		if(DEBUG) printf("[EINK] Frame unchanged, upload skipped\n");
+		_upload.acked = length;
+		_upload.complete = true;
+		_stats.skippedUploads++;
+		_stats.bytesSkipped += length;
+		return true;
+	}
+
+	if(first > 0 || last < EINK_CONTENT_BANDS - 1){
+		// only some bands changed, send the rows covering them
+		int top = first * EINK_CONTENT_BAND_ROWS;
+		int bottom = (last + 1) * EINK_CONTENT_BAND_ROWS;
+		if(bottom > EINK_HEIGHT){
+			bottom = EINK_HEIGHT;
+		}
+		if(DEBUG) printf("[EINK] Frame changed in rows %d-%d\n", top, bottom);
+		_upload.data = buff + EINK_HEADER_LENGTH + top * rowBytes;
+		_upload.length = (bottom - top) * rowBytes;
+		_upload.headerLength = 0;
+		_upload.packetLength = EInk44::packetLength(rowBytes);
+		_upload.y = top;
+		_upload.h = bottom - top;
+		_upload.roi = true;
+		_stats.shrunkUploads++;
+		_stats.bytesSkipped += length - _upload.length;
+	}
+
+	_forgetContent(0, _upload.y, EINK_WIDTH, _upload.h);
+	_stats.uploads++;
+	bool ok = _startUpload();
+	_policy->noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, buff + EINK_HEADER_LENGTH, rowBytes);
+	if(ok){
+		memcpy(_bandHash, bands, sizeof(_bandHash));
+		for(i = 0; i < EINK_CONTENT_BANDS; i++){
+			_bandKnown[i] = true;
+		}
+	}
+	_saveState();
+	return ok;
+}
 
-	bool imageWrite = true;
-	for(i = 0; i < packets - 1; i++)
-	  imageWrite &= _sendImagePacket(&buff[i*packetLength], i, packetLength);
-	imageWrite &= _sendImagePacket(&buff[i*packetLength], 0, lastPacketLength);
-	if(DEBUG) printf("\n");
 
-	return imageWrite;
+int EInk44::packetLength(int rowBytes){
+	if(rowBytes <= 0){
+		return 0;
+	}
+	// Packets carry whole rows where a row fits in one
+	return (rowBytes <= MAX_PACKET_LENGTH) ? rowBytes * (MAX_PACKET_LENGTH / rowBytes) : MAX_PACKET_LENGTH;
 }
 
+bool EInk44::sendImageROI(unsigned char * buff, int x, int y, int w, int h){
+	return sendImageROI(buff, w / 8, x, y, w, h);
+}
 
-bool EInk44::sendImageROI(unsigned char * buff, int x, int y, int w, int h, int retrynum){
+bool EInk44::sendImageROI(EInkImage& img, int x, int y, int w, int h){
+	if(x < 0 || y < 0 || x + w > img.width() || y + h > img.height()){
+		return false;
+	}
+	return sendImageROI(img.row(y) + x / 8, img.stride(), x, y, w, h);
+}
+
+bool EInk44::sendImageROI(unsigned char * buff, int stride, int x, int y, int w, int h){
+	if(!_checkHealth()){
+		return false;
+	}
 
 	// Make sure it doesnt go out of bounds
-	h = (y + h > 400) ? 400 - y : h;
-	int packetLength = (w > 250) ? w / 2 : w;
+	h = (y + h > EINK_HEIGHT) ? EINK_HEIGHT - y : h;
+	w = (x + w > EINK_WIDTH) ? EINK_WIDTH - x : w;
+	int rowBytes = w / 8;
+	if(rowBytes <= 0 || h <= 0){
+		return false;
+	}
+	int packet = packetLength(rowBytes);
+
+	_upload.data = buff;
+	_upload.length = rowBytes * h;
+	_upload.headerLength = 0;
+	_upload.stride = stride;
+	_upload.packetLength = packet;
+	_upload.x = x;
+	_upload.y = y;
+	_upload.w = w;
+	_upload.h = h;
+	_upload.roi = true;
+
+	if(DEBUG) printf("Send image ROI(%d, %d).\n", _upload.length, _upload.packetLength);
+	if(DEBUG) printf("=================================\n");
+
+	if(!_dedup){
+		_forgetContent(x, y, w, h);
+		_stats.uploads++;
+		bool ok = _startUpload();
+		_policy->noteUpload(x, y, w, h, buff, stride);
+		_saveState();
+		return ok;
+	}
+
+	// The same content was written to the same ROI before and nothing
+	// has been written on top of it since
+	uint32_t hash = _hashUpload();
+	ContentROI* known = NULL;
 	int i;
-	int length = w * h / 8;
-	int packets = (length / packetLength) + 1;
-	int lastPacketLength = length % packetLength;
+	for(i = 0; i < _roiCount; i++){
+		if(_rois[i].x == x && _rois[i].y == y && _rois[i].w == w && _rois[i].h == h){
+			known = &_rois[i];
+		}
+	}
+	if(NULL != known && known->hash == hash){
+		if(DEBUG) printf("[EINK] ROI unchanged, upload skipped\n");
+		_upload.acked = _upload.length;
+		_upload.complete = true;
+		_stats.skippedUploads++;
+		_stats.bytesSkipped += _upload.length;
+		return true;
+	}
 
-	_setImageROI(x, y, w, h);
+	_forgetContent(x, y, w, h);
+	_stats.uploads++;
+	bool ok = _startUpload();
+	_policy->noteUpload(x, y, w, h, buff, stride);
+	if(ok){
+		if(_roiCount == EINK_CONTENT_MAX_ROIS){
+			memmove(&_rois[0], &_rois[1], (EINK_CONTENT_MAX_ROIS - 1) * sizeof(ContentROI));
+			_roiCount--;
+		}
+		ContentROI& r = _rois[_roiCount++];
+		r.x = x;
+		r.y = y;
+		r.w = w;
+		r.h = h;
+		r.hash = hash;
+	}
+	_saveState();
+	return ok;
+}
 
-	if(DEBUG) printf("Send image(%d, %d, %d, %d).\n", length, packetLength, packets, lastPacketLength);
-	if(DEBUG) printf("=================================\n");
-	bool imageWrite = false;
-	for(i = 0; i < packets - 1; i++)
-		imageWrite |= _sendImagePacket(&buff[i*packetLength], i, packetLength);
-	if(lastPacketLength > 0){
-		imageWrite |= _sendImagePacket(&buff[i*packetLength], 0, lastPacketLength);
+bool EInk44::resumeUpload(){
+	if(_upload.complete){
+		return true;
+	}
+	if(_failed && !_recovering){
+		return false;
 	}
 
-	if(!imageWrite && retrynum == 0){
-		sendImageROI(buff, x, y, w, h, retrynum + 1);
+	int rowBytes = _upload.w / 8;
+	int rows = (_upload.acked - _upload.headerLength) / rowBytes;
+
+	// Nothing past the header has landed, so start over the same way
+	if(_upload.acked <= _upload.headerLength || rows <= 0){
+		_upload.acked = 0;
+		if(_upload.roi){
+			_setImageROI(_upload.x, _upload.y, _upload.w, _upload.h, true);
+		} else if(!_resetDataPointer()){
+			return false;
+		}
+		return _sendImageData(0);
 	}
 
-	return imageWrite;
+	// Point an ROI at the first row that was not completely acknowledged
+	// and stream from there. At most one row is sent twice.
+	if(DEBUG) printf("[EINK] Resume upload at row %d\n", rows);
+	_setImageROI(_upload.x, _upload.y + rows, _upload.w, _upload.h - rows, true);
+	return _sendImageData(_upload.headerLength + rows * rowBytes);
+}
+
+const EInkUpload& EInk44::lastUpload(){
+	return _upload;
+}
+
+void EInk44::setUploadMode(EInkUploadMode mode){
+	_uploadMode = mode;
+}
+
+EInkUploadMode EInk44::uploadMode(){
+	return _uploadMode;
+}
+
+void EInk44::setRetryPolicy(RetryPolicy& policy){
+	_retry = policy;
+}
+
+RetryPolicy& EInk44::retryPolicy(){
+	return _retry;
 }
 
 void EInk44::fill(bool white){
-	_setImageROI(0, 0, EINK_WIDTH, EINK_HEIGHT);
-	usleep(1000);
+	if(!_checkHealth()){
+		return;
+	}
+	_frame->clear(white);
+	_frameValid = true;
+	_forgetContent(0, 0, EINK_WIDTH, EINK_HEIGHT);
+	_policy->noteUnknown(0, 0, EINK_WIDTH, EINK_HEIGHT);
+	if(_setImageROI(0, 0, EINK_WIDTH, EINK_HEIGHT, false)){
+		_clock->sleep(1000);
+	}
 	_uploadImageFixVal(0, white);
+	_saveState();
 }
 
 void EInk44::fillROI(int x, int y, int w, int h, bool white){
-	_setImageROI(x, y, w, h);
-	usleep(1000);
+	if(!_checkHealth()){
+		return;
+	}
+	_frame->fillRect(x, y, w, h, white);
+	_forgetContent(x, y, w, h);
+	_policy->noteUnknown(x, y, w, h);
+	if(_setImageROI(x, y, w, h, false)){
+		_clock->sleep(1000);
+	}
 	_uploadImageFixVal(0, white);
+	_saveState();
 }
 
 void EInk44::copyImageROI(int x, int y, int w, int h, int slot){
-	_setImageROI(x, y, w, h);
-	usleep(10000);
+	if(!_checkHealth()){
+		return;
+	}
+	// the slot's content is not known here, so no frame can be replayed
+	_frameValid = false;
+	_forgetContent(x, y, w, h);
+	_policy->noteUnknown(x, y, w, h);
+	if(_setImageROI(x, y, w, h, false)){
+		_clock->sleep(10000);
+	}
 	_copyLastSlot(slot);
+	_saveState();
 }
 
 void EInk44::copyImageROI(int x, int y, int w, int h){
@@ -165,26 +579,354 @@ void EInk44::copyImageROI(int x, int y, int w, int h){
 }
 
 
+void EInk44::setDeduplication(bool enabled){
+	_dedup = enabled;
+}
+
+bool EInk44::deduplication(){
+	return _dedup;
+}
+
+void EInk44::invalidateContent(){
+	int i;
+	for(i = 0; i < EINK_CONTENT_BANDS; i++){
+		_bandKnown[i] = false;
+	}
+	_roiCount = 0;
+	_changed = false;
+	_shown = false;
+	_saveState();
+}
+
+const EInkContentStats& EInk44::contentStats(){
+	return _stats;
+}
+
+bool EInk44::attachState(const char* path){
+	size_t length = sizeof(EInkSavedState) + _policy->stateLength();
+	if(!_state.open(path, length)){
+		return false;
+	}
+	EInkSavedState* s = (EInkSavedState*)_state.data();
+	bool valid = _state.valid();
+	bool resume = _state.current() && s->powered;
+
+	// The clock and BUSY timings found for this wiring hold across boots,
+	// the rest only while the panel has not lost power since it was written
+	if(valid && s->speed >= MIN_SPI_SPEED && s->speed <= MAX_SPI_SPEED){
+		_spi->setSpeed(s->speed);
+	}
+	if(valid){
+		int c;
+		for(c = 0; c < EINK_BUSY_COMMANDS; c++){
+			_busyModel.setEstimate((EInkBusyCommand)c, s->busy[c]);
+		}
+	}
+	if(resume){
+		int i;
+		for(i = 0; i < EINK_CONTENT_BANDS; i++){
+			_bandKnown[i] = 0 != s->bandKnown[i];
+			_bandHash[i] = s->bandHash[i];
+		}
+		_roiCount = (s->roiCount < 0 || s->roiCount > EINK_CONTENT_MAX_ROIS) ? 0 : s->roiCount;
+		for(i = 0; i < _roiCount; i++){
+			_rois[i].x = s->rois[i][0];
+			_rois[i].y = s->rois[i][1];
+			_rois[i].w = s->rois[i][2];
+			_rois[i].h = s->rois[i][3];
+			_rois[i].hash = s->rois[i][4];
+		}
+		_changed = 0 != s->changed;
+		_shown = 0 != s->shown;
+		_lastTransition = (EInkTransition)s->lastTransition;
+		_lastUpdateTime = s->lastUpdateTime;
+		// the policy block was saved with the last update, content written
+		// or forgotten after it is not in there
+		if(_policy->restoreState(_state.data() + sizeof(EInkSavedState), _policy->stateLength()) && (_changed || !_shown)){
+			_policy->noteUnknown(0, 0, EINK_WIDTH, EINK_HEIGHT);
+		}
+		_powered = true;
+
+		// the controller is up, the SPI settings of this process are not
+		invalidateControllerState();
+		_spi->on();
+	}
+	_saveState(true);
+	if(DEBUG) printf("[EINK] State %s: %s\n", path, resume ? "resumed" : "not resumable");
+	return resume;
+}
+
+EInkTransition EInk44::lastTransition(){
+	return _lastTransition;
+}
+
+uint64_t EInk44::lastUpdateTime(){
+	return _lastUpdateTime;
+}
+
+bool EInk44::recover(){
+	uint64_t start = _clock->now();
+	EInkUpload interrupted = _upload;
+	EInk44* self = this;
+	bool ok = false;
+	int attempt;
+
+	_recovering = true;
+	_health.recoveries++;
+	for(attempt = 0; attempt < EINK_RECOVERY_ATTEMPTS && !ok; attempt++){
+		if(DEBUG) printf("[EINK] Recovery attempt %d\n", attempt);
+
+		// EN high cuts the controller's supply, the power up sequence
+		// brings it back from reset
+		disable();
+		_clock->sleep(EINK_RECOVERY_OFF_TIME);
+		_spi->invalidate();
+		powerSequence(&self, 1);
+		_timeoutRun = 0;
+		_errorRun = 0;
+
+		// the image buffer did not survive, the screen did
+		invalidateContent();
+		_policy->noteUnknown(0, 0, EINK_WIDTH, EINK_HEIGHT);
+
+		ok = _waitForBusy(MAX_TIMEOUT, EINK_BUSY_POWER) && (!_frameValid || _replayFrame()) && !_stuck();
+		if(!ok){
+			_health.failedAttempts++;
+		}
+	}
+	_upload = interrupted;
+	_recovering = false;
+	_failed = !ok;
+
+	_health.lastRecoveryTime = _clock->now() - start;
+	_health.recoveryTime += _health.lastRecoveryTime;
+	if(!ok){
+		warnx("EInk44: panel still stuck after %d power cycles, giving up", EINK_RECOVERY_ATTEMPTS);
+	}
+	return ok;
+}
+
+void EInk44::setLatencyRecorder(LatencyRecorder* recorder){
+	_latency = recorder;
+}
+
+LatencyRecorder* EInk44::latencyRecorder(){
+	return _latency;
+}
+
+bool EInk44::lockMemory(){
+	bool ok = 0 == mlock(_spi->txBuffer(), _spi->bufferSize()) &&
+		0 == mlock(_spi->rxBuffer(), _spi->bufferSize()) &&
+		0 == mlock(_frame->bits(), _frame->length());
+	if(!ok){
+		warn("EInk44: cannot lock buffers");
+	}
+	return ok;
+}
+
+EInkBusyModel& EInk44::busyModel(){
+	return _busyModel;
+}
+
+bool EInk44::failed(){
+	return _failed;
+}
+
+const EInkHealthStats& EInk44::health(){
+	return _health;
+}
+
 bool EInk44::isBusy(){
-	struct timeval end_time; 
-	gettimeofday( &end_time, NULL ); 
-    int elapsed_time = (end_time.tv_sec - last_update_time.tv_sec) * 1e6 + 
-    	( end_time.tv_usec - last_update_time.tv_usec ) ;
-    if(elapsed_time < MIN_UPDATE_TIMEOUT){
-    	return true;
-    }
+	if(!_updateMin.expired()){
+		return true;
+	}
 
 	if(GPIO::GPIO_read(_busy) == 0){
-		if(elapsed_time < MAX_UPDATE_TIMEOUT){
-	    	return true;
-	    }
-    }
-    return false;
+		if(!_updateMax.expired()){
+			return true;
+		}
+	}
+	return false;
+}
+
+int EInk44::pollFd(){
+	if(_epoll >= 0){
+		return _epoll;
+	}
+
+	_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if(_epoll < 0){
+		warn("EInk44: epoll_create1 failed");
+		return -1;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+
+	_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(_timer >= 0){
+		ev.events = EPOLLIN;
+		ev.data.fd = _timer;
+		epoll_ctl(_epoll, EPOLL_CTL_ADD, _timer, &ev);
+	}
+
+	// Without edge support the timer alone paces the update window
+	short events = 0;
+	_busyFd = GPIO::GPIO_edge_fd(_busy, &events);
+	if(_busyFd >= 0){
+		ev.events = 0;
+		if(events & POLLIN){
+			ev.events |= EPOLLIN;
+		}
+		if(events & POLLPRI){
+			ev.events |= EPOLLPRI;
+		}
+		if(events & POLLERR){
+			ev.events |= EPOLLERR;
+		}
+		ev.data.fd = _busyFd;
+		epoll_ctl(_epoll, EPOLL_CTL_ADD, _busyFd, &ev);
+		GPIO::GPIO_edge_ack(_busy);
+	}
+
+	if(!_updateMin.expired()){
+		_armTimer(_updateMin.remaining());
+	}
+	return _epoll;
+}
+
+bool EInk44::processEvents(){
+	if(_timer >= 0){
+		uint64_t expirations;
+		while(read(_timer, &expirations, sizeof(expirations)) > 0){
+		}
+	}
+
+	int busy;
+	if(_busyFd >= 0){
+		busy = (GPIO::GPIO_edge_ack(_busy) == 0);
+	} else {
+		busy = (GPIO::GPIO_read(_busy) == 0);
+	}
+
+	// Sleep until the minimum window closes; after that BUSY going high
+	// wakes the loop and the timer only guards the maximum window
+	if(!_updateMin.expired()){
+		_armTimer(_updateMin.remaining());
+		return true;
+	}
+	if(busy && !_updateMax.expired()){
+		_armTimer((_busyFd >= 0) ? _updateMax.remaining() : 1000);
+		return true;
+	}
+	_armTimer(0);
+	return false;
+}
+
+void EInk44::_armTimer(uint64_t us){
+	if(_timer < 0){
+		return;
+	}
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	// zero leaves it_value empty, which disarms the timer
+	if(us > 0){
+		its.it_value.tv_sec = us / 1000000;
+		its.it_value.tv_nsec = (us % 1000000) * 1000;
+	}
+	timerfd_settime(_timer, 0, &its, NULL);
+}
+
+void EInk44::setClock(Clock* clock){
+	_clock = (NULL == clock) ? Clock::monotonic() : clock;
+}
+
+Clock* EInk44::clock(){
+	return _clock;
 }
 
 /* Private Helpers */
 
-void EInk44::_sendUpdate(unsigned char transition){
+// Drop what is known about a region of the image buffer before it is
+// written, so a failed write leaves nothing stale behind
+void EInk44::_forgetContent(int x, int y, int w, int h){
+	int kept = 0;
+	int i;
+	for(i = 0; i < _roiCount; i++){
+		ContentROI& r = _rois[i];
+		bool overlaps = r.x < x + w && x < r.x + r.w && r.y < y + h && y < r.y + r.h;
+		if(!overlaps){
+			_rois[kept++] = r;
+		}
+	}
+	_roiCount = kept;
+
+	for(i = 0; i < EINK_CONTENT_BANDS; i++){
+		int top = i * EINK_CONTENT_BAND_ROWS;
+		if(top < y + h && y < top + EINK_CONTENT_BAND_ROWS){
+			_bandKnown[i] = false;
+		}
+	}
+	_changed = true;
+	_saveState();
+}
+
+// Write everything attachState() restores to the state file, if any.
+// Content is forgotten before it is written and saved again once it
+// landed, so a process dying in between never leaves stale hashes. The
+// policy block is by far the largest part and only written when asked.
+void EInk44::_saveState(bool policy){
+	if(!_state.isOpen()){
+		return;
+	}
+	EInkSavedState* s = (EInkSavedState*)_state.data();
+	_state.begin();
+	s->lastUpdateTime = _lastUpdateTime;
+	s->lastTransition = _lastTransition;
+	s->speed = _spi->speed();
+	s->powered = _powered;
+	s->changed = _changed;
+	s->shown = _shown;
+	int i;
+	for(i = 0; i < EINK_CONTENT_BANDS; i++){
+		s->bandKnown[i] = _bandKnown[i];
+		s->bandHash[i] = _bandHash[i];
+	}
+	for(i = 0; i < EINK_BUSY_COMMANDS; i++){
+		s->busy[i] = _busyModel.estimate((EInkBusyCommand)i);
+	}
+	s->roiCount = _roiCount;
+	for(i = 0; i < _roiCount; i++){
+		s->rois[i][0] = _rois[i].x;
+		s->rois[i][1] = _rois[i].y;
+		s->rois[i][2] = _rois[i].w;
+		s->rois[i][3] = _rois[i].h;
+		s->rois[i][4] = _rois[i].hash;
+	}
+	// a policy swapped in since attaching may not fit the file
+	if(policy && _state.length() == sizeof(EInkSavedState) + _policy->stateLength()){
+		_policy->saveState(_state.data() + sizeof(EInkSavedState));
+	}
+	_state.commit();
+}
+
+void EInk44::_sendUpdate(unsigned char transition, bool force){
+	if(!_checkHealth()){
+		return;
+	}
+	if(_dedup && !force && _shown && !_changed && transition == _lastTransition){
+		if(DEBUG) printf("[EINK] Nothing changed, update skipped\n");
+		_stats.skippedUpdates++;
+		return;
+	}
+	_changed = false;
+	_shown = true;
+	_stats.updates++;
+	_lastTransition = (EInkTransition)transition;
+	_lastUpdateTime = _clock->now();
+	_policy->noteUpdate(_lastTransition, _lastUpdateTime);
+	_saveState(true);
+
 	if(DEBUG) printf("Display update...");
 	inout[0] = transition;
 	inout[1] = 0x01;
@@ -198,156 +940,485 @@ void EInk44::_sendUpdate(unsigned char transition){
 	_spi->disable();
 	if(DEBUG) printf("\n");
 
-	gettimeofday( &last_update_time, NULL ); 
+	_updateMin = Deadline(_clock, MIN_UPDATE_TIMEOUT);
+	_updateMax = Deadline(_clock, MAX_UPDATE_TIMEOUT);
+	_armTimer(MIN_UPDATE_TIMEOUT);
 
 	// _waitForBusy(MAX_UPDATE_TIMEOUT);
 }
 
-int EInk44::_readResponse(int tryn){
-	// return true;
-	// Read response
+int EInk44::_readResponse(){
+	int attempt;
+	for(attempt = 0; ; attempt++){
+		inout[0] = 0x00;
+		inout[1] = 0x00;
+		inout[2] = 0x00;
+		inout[3] = 0x00;
+		inout[4] = 0x00;
+		inout[5] = 0x00;
+
+		_spi->enable();
+		_spi->read(inout, inout, 2);
+		_spi->disable();
+
+		_waitForBusy(MAX_RESPONSE_TIMEOUT, EINK_BUSY_RESPONSE);
+
+		// A floating or stuck MISO line reads as all zeros or all ones,
+		// so the status word has to be read again
+		int response = _parseResponse(inout);
+		_noteResponse(response);
+		if(response != 0){
+			return response;
+		}
 
-	if(tryn > 2){
-		return false;
+		if(DEBUG) printf("[EINK] [Unable to get proper response] [%d]: 0x%x 0x%x\n", attempt, inout[0], inout[1]);
+		if(_stuck() || !_retry.retry(attempt, _clock)){
+			return 0;
+		}
 	}
+}
 
-	inout[0] = 0x00;
-	inout[1] = 0x00;
-	inout[2] = 0x00;
-	inout[3] = 0x00;
-	inout[4] = 0x00;
-	inout[5] = 0x00;
-	
-	_spi->enable();
-	_spi->read(inout, inout, 2);
-	_spi->disable();
+// Send full size packets of alternating bits at the current clock and
+// count the ones that do not come back acknowledged
+int EInk44::_probeErrors(int packets){
+	invalidateControllerState();
+	if(!_resetDataPointer()){
+		return packets;
+	}
+	_pointerAtStart = false;
+
+	int errors = 0;
+	int i;
+	for(i = 0; i < packets; i++){
+		inout[0] = 0x20;
+		inout[1] = 0x01;
+		inout[2] = 0x00; // slot;
+		inout[3] = MAX_PACKET_LENGTH / 2;
+		memset(&inout[4], (i & 1) ? 0xAA : 0x55, MAX_PACKET_LENGTH / 2);
+
+		_spi->enable();
+		_spi->send(inout, 4 + MAX_PACKET_LENGTH / 2);
+		_spi->disable();
+		_waitForBusy(MAX_DATAPACKET_TIMEOUT, EINK_BUSY_PACKET);
+
+		inout[0] = 0x00;
+		inout[1] = 0x00;
+		_spi->enable();
+		_spi->read(inout, inout, 2);
+		_spi->disable();
+		_waitForBusy(MAX_RESPONSE_TIMEOUT, EINK_BUSY_RESPONSE);
+
+		if(_parseResponse(inout) != 0x9000){
+			errors++;
+		}
+	}
+	return errors;
+}
+
+// Track bad status words and drop the clock a step when too many of the
+// recent ones were bad
+void EInk44::_noteResponse(int response){
+	// 0x6A00 is the controller refusing a command, not a transfer error
+	if(response == 0x9000){
+		_errorRun = 0;
+	} else if(response != 0x6A00){
+		_badResponses++;
+		_health.errors++;
+		_errorRun++;
+	}
+	if(++_responses < SPI_ERROR_WINDOW && _badResponses < SPI_ERROR_LIMIT){
+		return;
+	}
+	if(_badResponses >= SPI_ERROR_LIMIT){
+		uint32_t current = _spi->speed();
+		int i = spi_speed_count - 1;
+		while(i > 0 && spi_speeds[i] >= current){
+			i--;
+		}
+		if(spi_speeds[i] < current){
+			if(DEBUG) printf("[EINK] %d bad responses, SPI clock down to %u Hz\n", _badResponses, spi_speeds[i]);
+			_spi->setSpeed(spi_speeds[i]);
+			_saveState();
+		}
+	}
+	_responses = 0;
+	_badResponses = 0;
+}
 
-	_waitForBusy(MAX_RESPONSE_TIMEOUT);
-	
-	if((inout[0] == 0x00 && inout[1] == 0x00) || (inout[0] == 0xFF && inout[1] == 0xFF)){
-		if(DEBUG) printf("[EINK] [Unable to get proper response] [%d]: 0x%x 0x%x\n", tryn, inout[0], inout[1]);
-		return _readResponse(tryn + 1);
+// Decode a two byte status word, 0 if nothing was driven on MISO
+int EInk44::_parseResponse(unsigned char * response){
+	if((response[0] == 0x00 && response[1] == 0x00) || (response[0] == 0xFF && response[1] == 0xFF)){
+		return 0;
 	}
 
-	if(inout[0] != 0x90 || inout[1] != 0x00){
-		usleep(1000);
-		if(DEBUG) printf("[EINK] Response: 0x%x 0x%x\n", inout[0], inout[1]);
-		if(inout[0] == 0x67 && inout[1] == 0x00){
+	if(response[0] != 0x90 || response[1] != 0x00){
+		if(DEBUG) printf("[EINK] Response: 0x%x 0x%x\n", response[0], response[1]);
+		if(response[0] == 0x67 && response[1] == 0x00){
 			return 0x6700;
-		} else if(inout[0] == 0x6A && inout[1] == 0x00){
+		} else if(response[0] == 0x6A && response[1] == 0x00){
 			return 0x6A00;
 		} else {
 			return 0xF0F0;
 		}
 	}
-	// printf("[EINK] [GOOD]: 0x%x 0x%x\n", inout[0], inout[1]);
-	
+	// printf("[EINK] [GOOD]: 0x%x 0x%x\n", response[0], response[1]);
+
 	return 0x9000;
 }
 
-bool EInk44::_sendImagePacket(unsigned char * buff, int packetNo, unsigned char packetLength, int retrynum)
-{
-	if(_hasBeenInited){
-		return _sendImagePacket(buff, packetNo, packetLength, 0x01, 0);
+bool EInk44::_startUpload(){
+	_upload.acked = 0;
+	_upload.complete = false;
+	if(!_recovering){
+		_recordUpload();
+	}
+
+	bool ok;
+	if(_upload.roi){
+		_setImageROI(_upload.x, _upload.y, _upload.w, _upload.h, true);
+		ok = true;
 	} else {
-		_hasBeenInited = true;
-		return _sendImagePacket(buff, packetNo, packetLength, 0x01, 0); //0x49, 0);
+		ok = _resetDataPointer();
 	}
+
+	if(ok){
+		if(_uploadMode == EINK_UPLOAD_PIPELINED){
+			ok = _sendImageDataPipelined();
+		} else {
+			ok = _sendImageData(0);
+		}
+	}
+
+	// Resumed uploads always take the acknowledged path, so a controller
+	// that does not answer pipelined reads still gets the frame
+	int resume;
+	for(resume = 0; !ok && !_stuck() && resume < _retry.resumes(); resume++){
+		ok = resumeUpload();
+	}
+
+	// A stuck panel gets no more packets. The frame replayed after the
+	// power cycle already holds this upload.
+	if(!ok && _stuck() && !_recovering && recover() && _frameValid){
+		_upload.acked = _upload.length;
+		_upload.complete = true;
+		ok = true;
+	}
+	return ok;
+}
+
+// Copy the rows of the current upload into the frame replayed after a
+// power cycle. Uploads that are not frames or ROIs of this panel leave
+// nothing to replay.
+void EInk44::_recordUpload(){
+	int rowBytes = _upload.w / 8;
+	if(!_upload.roi && _upload.length != EINK_HEADER_LENGTH + EINK_HEIGHT * rowBytes){
+		_frameValid = false;
+		return;
+	}
+	const unsigned char* pixels = _upload.data + _upload.headerLength;
+	int y;
+	for(y = 0; y < _upload.h; y++){
+		memcpy(_frame->row(_upload.y + y) + _upload.x / 8, pixels + (size_t)y * _upload.stride, rowBytes);
+	}
+	if(!_upload.roi){
+		_frameValid = true;
+	}
+}
+
+// Send the recorded frame as a plain acknowledged upload
+bool EInk44::_replayFrame(){
+	_upload.data = _frame->bits();
+	_upload.length = _frame->length();
+	_upload.headerLength = EINK_HEADER_LENGTH;
+	_upload.stride = _frame->stride();
+	_upload.packetLength = DEFAULT_PACKET_LENGTH;
+	_upload.x = 0;
+	_upload.y = 0;
+	_upload.w = EINK_WIDTH;
+	_upload.h = EINK_HEIGHT;
+	_upload.roi = false;
+	_upload.acked = 0;
+	_upload.complete = false;
+	return _resetDataPointer() && _sendImageData(0);
 }
 
-bool EInk44::_sendImagePacket(unsigned char * buff, int packetNo, unsigned char packetLength, unsigned char init, int retrynum){
-	if(retrynum > 5){
+bool EInk44::_stuck(){
+	return _timeoutRun >= EINK_STUCK_TIMEOUTS || _errorRun >= EINK_STUCK_ERRORS;
+}
+
+// Called before every command: false for a failed panel, and a stuck one
+// is recovered first
+bool EInk44::_checkHealth(){
+	if(_recovering){
+		return true;
+	}
+	if(_failed){
 		return false;
 	}
-	// printf("Send image packet(%d, %d). ", packetNo, packetLength);
-	inout[0] = 0x20;
-	inout[1] = init;
-	inout[2] = 0x00; // slot;
-	inout[3] = packetLength;
-	memcpy(&inout[4], buff, packetLength);
+	return !_stuck() || recover();
+}
 
-	_spi->enable();
-	_spi->send(inout, 4 + packetLength);
-	_spi->disable();
+// Stream the current upload to the controller packet by packet, starting
+// at the given byte offset. A packet that is rejected is resent on its own,
+// so a failure never restarts the frame.
+bool EInk44::_sendImageData(int offset){
+	int packetNo = 0;
+	_pointerAtStart = false;
+	_upload.acked = offset;
+	while(_upload.acked < _upload.length){
+		int n = _upload.length - _upload.acked;
+		if(n > _upload.packetLength){
+			n = _upload.packetLength;
+		}
+		if(!_sendImagePacket(_upload.acked, packetNo, n)){
+			if(DEBUG) printf("[EINK] [ERROR] Image upload failed at byte %d\n", _upload.acked);
+			return false;
+		}
+		_upload.acked += n;
+		packetNo++;
+	}
+	_upload.complete = true;
+	if(DEBUG) printf("\n");
+	return true;
+}
+
+// Stream the current upload from the start, reading the status word of
+// each packet in the same full-duplex transfer that sends the next one.
+// That saves a CS cycle and a BUSY wait per packet. When a status comes
+// back bad the packet sent after it is discarded by the resume, which
+// re-establishes the ROI at the last acknowledged row.
+bool EInk44::_sendImageDataPipelined(){
+	_pointerAtStart = false;
+	int sent = 0;
+	int pending = 0;
+	_upload.acked = 0;
+	while(sent < _upload.length){
+		int n = _upload.length - sent;
+		if(n > _upload.packetLength){
+			n = _upload.packetLength;
+		}
+		inout[0] = 0x20;
+		inout[1] = 0x01;
+		inout[2] = 0x00; // slot;
+		inout[3] = n;
+		_copyPacket(&inout[4], sent, n);
+
+		uint64_t start = _clock->now();
+		_spi->enable();
+		if(pending > 0){
+			_spi->read(inout, _status, 4 + n);
+		} else {
+			_spi->send(inout, 4 + n);
+		}
+		_spi->disable();
 
-	// Wait till its free
-	_waitForBusy(MAX_DATAPACKET_TIMEOUT);
+		_waitForBusy(MAX_DATAPACKET_TIMEOUT, EINK_BUSY_PACKET);
+		if(NULL != _latency){
+			_latency->record(_clock->now() - start);
+		}
+		if(_stuck()){
+			invalidateControllerState();
+			return false;
+		}
 
-	int response = _readResponse();
-	if(response != 0x9000){
-		if(DEBUG) printf("[EINK] [ERROR] Invalid send image packet: _sendImagePacket(%d, %d, 0x%x)\n", packetNo, packetLength, init);
-		if(true || response == 0x6D00 || response == 0x6700){
-			printf("Send Failed.\n");
-			if(retrynum < 3){
-				return _sendImagePacket(buff, packetNo, packetLength, init, retrynum + 1);
-			} else {
+		if(pending > 0){
+			int response = _parseResponse(_status);
+			_noteResponse(response);
+			if(response != 0x9000){
+				if(DEBUG) printf("[EINK] [ERROR] Pipelined packet at byte %d = 0x%x\n", _upload.acked, response);
+				invalidateControllerState();
 				return false;
 			}
+			_upload.acked += pending;
 		}
+		pending = n;
+		sent += n;
 	}
 
+	// Nothing follows the last packet, so its status is read on its own
+	if(pending > 0){
+		if(_readResponse() != 0x9000){
+			invalidateControllerState();
+			return false;
+		}
+		_upload.acked += pending;
+	}
+	_upload.complete = true;
 	return true;
 }
 
-bool EInk44::_resetDataPointer(int retrynum){
-	if(DEBUG) printf("Reset data pointer. ");
-
-	if(retrynum > 2){
-		return false;
+// Gather length bytes of the upload, starting at a byte offset into the
+// packed stream, from the source rows wherever they are
+void EInk44::_copyPacket(unsigned char* dst, int offset, int length){
+	if(offset < _upload.headerLength){
+		int n = _upload.headerLength - offset;
+		if(n > length){
+			n = length;
+		}
+		memcpy(dst, &_upload.data[offset], n);
+		dst += n;
+		offset += n;
+		length -= n;
 	}
 
-	// disable();
-	// usleep(1000);
-	// enable();
+	int rowBytes = _upload.w / 8;
+	const unsigned char* pixels = _upload.data + _upload.headerLength;
+	int pos = offset - _upload.headerLength;
+	while(length > 0){
+		int row = pos / rowBytes;
+		int col = pos % rowBytes;
+		int n = rowBytes - col;
+		if(n > length){
+			n = length;
+		}
+		memcpy(dst, pixels + (size_t)row * _upload.stride + col, n);
+		dst += n;
+		pos += n;
+		length -= n;
+	}
+}
 
-	// return;
+// Hash of the pixel rows of the current upload, chained row by row so the
+// same pixels hash the same whatever the source stride
+uint32_t EInk44::_hashUpload(){
+	int rowBytes = _upload.w / 8;
+	const unsigned char* pixels = _upload.data + _upload.headerLength;
+	uint32_t hash = 0;
+	int y;
+	for(y = 0; y < _upload.h; y++){
+		hash = contentHash(pixels + (size_t)y * _upload.stride, rowBytes, hash);
+	}
+	return hash;
+}
 
-	inout[0] = 0x20;
-	inout[1] = 0x0D;
-	inout[2] = 0x00;
-	inout[3] = 0x00;
-	inout[4] = 0x00;
-	inout[5] = 0x00;
+bool EInk44::_sendImagePacket(int offset, int packetNo, unsigned char packetLength){
+	int attempt;
+	for(attempt = 0; ; attempt++){
+		// printf("Send image packet(%d, %d). ", packetNo, packetLength);
+		inout[0] = 0x20;
+		inout[1] = 0x01;
+		inout[2] = 0x00; // slot;
+		inout[3] = packetLength;
+		_copyPacket(&inout[4], offset, packetLength);
+
+		uint64_t start = _clock->now();
+		_spi->enable();
+		_spi->send(inout, 4 + packetLength);
+		_spi->disable();
+
+		// Wait till its free
+		_waitForBusy(MAX_DATAPACKET_TIMEOUT, EINK_BUSY_PACKET);
+
+		int response = _readResponse();
+		if(NULL != _latency){
+			_latency->record(_clock->now() - start);
+		}
+		if(response == 0x9000){
+			return true;
+		}
 
-	_spi->enable();
-	_spi->send(inout, 3);
-	_spi->disable();
+		if(DEBUG) printf("[EINK] [ERROR] Invalid send image packet: _sendImagePacket(%d, %d) = 0x%x\n", packetNo, packetLength, response);
+		invalidateControllerState();
+		if(_stuck() || !_retry.retry(attempt, _clock)){
+			printf("Send Failed.\n");
+			return false;
+		}
+	}
+}
 
-	if(DEBUG) printf("\n"); 
+bool EInk44::_resetDataPointer(){
+	// nothing was written since the last reset
+	if(_framePointer && _pointerAtStart){
+		if(DEBUG) printf("Data pointer already reset.\n");
+		return true;
+	}
 
-	_waitForBusy(MAX_TIMEOUT);
+	int attempt;
+	for(attempt = 0; ; attempt++){
+		if(DEBUG) printf("Reset data pointer. ");
+
+		inout[0] = 0x20;
+		inout[1] = 0x0D;
+		inout[2] = 0x00;
+		inout[3] = 0x00;
+		inout[4] = 0x00;
+		inout[5] = 0x00;
+
+		_spi->enable();
+		_spi->send(inout, 3);
+		_spi->disable();
+
+		if(DEBUG) printf("\n");
+
+		_waitForBusy(MAX_TIMEOUT, EINK_BUSY_POINTER);
+
+		int response = _readResponse();
+		if(response != 0x6700){
+			// the full frame header sets the geometry again, so the ROI
+			// is unknown from here on
+			_roiKnown = false;
+			_framePointer = 0x9000 == response;
+			_pointerAtStart = _framePointer;
+			return true;
+		}
 
-	if(_readResponse() == 0x6700){
 		if(DEBUG) printf("[EINK] [ERROR] Invalid reset data pointer. Try again...\n");
-		return _resetDataPointer(retrynum + 1);
+		if(_stuck() || !_retry.retry(attempt, _clock)){
+			return false;
+		}
 	}
-	return true;
 }
 
 void EInk44::waitUntilFree(){
-	_waitForBusy(MAX_TIMEOUT);
-	while(isBusy()) {
-		usleep(10);
-	}
-}
-
-void EInk44::_waitForBusy(int timeout){
-	usleep(1000);
-	int elapsed_time; 
-    struct timeval start_time, end_time; 
-    gettimeofday( &start_time, NULL ); 
-    // printf("Elapsed time: 0\n");
-    while(GPIO::GPIO_read(_busy) == 0){
-		gettimeofday( &end_time, NULL ); 
-        elapsed_time = (end_time.tv_sec - start_time.tv_sec) * 1e6 + 
-        	( end_time.tv_usec - start_time.tv_usec ) ;
-        // printf("Elapsed time: %d / %d\n", elapsed_time, timeout);
-		if(elapsed_time > timeout){
-			printf("[TIMEOUT!!] %d\n", elapsed_time);
-			break;
+	_waitForBusy(MAX_TIMEOUT, EINK_BUSY_OTHER);
+
+	// A virtual clock has to be slept on to move forward
+	if(!_clock->isReal() || pollFd() < 0){
+		while(isBusy()) {
+			_clock->sleep(10);
+		}
+		return;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = _epoll;
+	pfd.events = POLLIN;
+	while(processEvents()){
+		pfd.revents = 0;
+		poll(&pfd, 1, MAX_UPDATE_TIMEOUT / 1000);
+	}
+}
+
+// Sleep until just before the command is expected to finish, then spin on
+// BUSY for a short window and poll slowly after that. Returns false on a
+// timeout, which counts towards the panel being stuck unless a display
+// update is still within its window.
+bool EInk44::_waitForBusy(int timeout, EInkBusyCommand command){
+	if(_failed && !_recovering){
+		return false;
+	}
+	uint64_t start = _clock->now();
+	_clock->sleep(_busyModel.sleepTime(command));
+	Deadline deadline(_clock, timeout);
+
+	// a virtual clock only moves when slept on
+	Deadline spin(_clock, _clock->isReal() ? _busyModel.spinTime(command) : 0);
+	while(GPIO::GPIO_read(_busy) == 0){
+		if(deadline.expired()){
+			printf("[TIMEOUT!!] %d\n", (int)deadline.elapsed());
+			if(_updateMax.expired()){
+				_health.timeouts++;
+				_timeoutRun++;
+			}
+			return false;
+		}
+		if(spin.expired()){
+			_clock->sleep(100);
 		}
-		usleep(100);
 	}
+	_timeoutRun = 0;
+	_busyModel.note(command, _clock->now() - start);
+	return true;
 }
 
 void EInk44::_copyLastSlot(int slot){
@@ -359,7 +1430,8 @@ void EInk44::_copyLastSlot(int slot){
 	_spi->enable();
 	_spi->send(inout, 5);
 	_spi->disable();
-	_waitForBusy(MAX_TIMEOUT);
+	_waitForBusy(MAX_TIMEOUT, EINK_BUSY_COPY);
+	_pointerAtStart = false;
 }
 
 void EInk44::_uploadImageFixVal(int slot, bool white){
@@ -374,11 +1446,19 @@ void EInk44::_uploadImageFixVal(int slot, bool white){
 	_spi->enable();
 	_spi->send(inout, 5);
 	_spi->disable();
-	_waitForBusy(MAX_TIMEOUT);
+	_waitForBusy(MAX_TIMEOUT, EINK_BUSY_FILL);
+	_pointerAtStart = false;
 }
 
-void EInk44::_setImageROI(int x, int y, int w, int h)
+// Returns false if the controller already had this ROI. Uploads pass
+// rewind, as setting the ROI is also what moves the data pointer back to
+// its first byte.
+bool EInk44::_setImageROI(int x, int y, int w, int h, bool rewind)
 {
+	if(_roiKnown && _roi[0] == x && _roi[1] == y && _roi[2] == w && _roi[3] == h && (!rewind || _pointerAtStart)){
+		if(DEBUG) printf("ROI (%d, %d) @ (%d, %d) already set.\n", w, h, x, y);
+		return false;
+	}
 	if(DEBUG) printf("Set ROI (%d, %d) @ (%d, %d).\n", w, h, x, y);
 	inout[0] = 0x20;
 	inout[1] = 0x0A;
@@ -421,7 +1501,16 @@ void EInk44::_setImageROI(int x, int y, int w, int h)
 	// 	//printf("[EINK] [ERROR] Invalid set image ROI..\n");
 	// }
 
-	_waitForBusy(MAX_TIMEOUT);
+	_waitForBusy(MAX_TIMEOUT, EINK_BUSY_ROI);
+
+	_roiKnown = true;
+	_roi[0] = x;
+	_roi[1] = y;
+	_roi[2] = w;
+	_roi[3] = h;
+	_pointerAtStart = true;
+	_framePointer = false;
+	return true;
 }
 
 }
@@ -10,11 +10,18 @@
 #include <string.h>
 #include <unistd.h>
 #include <err.h>
-#include <sys/time.h> 
 
 #include "gpio.h"
 #include "spi.h"
 #include "EInkImage.h"
+#include "EInkFrameStore.h"
+#include "RetryPolicy.h"
+#include "Clock.h"
+#include "ContentHash.h"
+#include "EInkUpdatePolicy.h"
+#include "EInkPanelState.h"
+#include "LatencyRecorder.h"
+#include "EInkBusyModel.h"
 
 #define EINK_WIDTH	 400
 #define EINK_HEIGHT 300
@@ -27,33 +34,172 @@
 
 #define DEFAULT_PACKET_LENGTH 40
 
+#define DEFAULT_SPI_SPEED 8000000
+#define MIN_SPI_SPEED 1000000
+#define MAX_SPI_SPEED 24000000
+
+// Runtime backoff: this many bad status words among the last
+// SPI_ERROR_WINDOW drops the clock one step
+#define SPI_ERROR_WINDOW 64
+#define SPI_ERROR_LIMIT 4
+#define SPI_PROBE_PACKETS 32
+#define MAX_PACKET_LENGTH 250
+
+// Full frames are compared in bands of this many rows, so a frame that
+// changed in one place is sent as the smallest ROI covering the change
+#define EINK_CONTENT_BAND_ROWS 20
+#define EINK_CONTENT_BANDS ((EINK_HEIGHT + EINK_CONTENT_BAND_ROWS - 1) / EINK_CONTENT_BAND_ROWS)
+#define EINK_CONTENT_MAX_ROIS 32
+
+#define EINK_SPIDEV "/dev/spidev1.0"
+
+// A panel counts as stuck after this many BUSY timeouts or bad status
+// words in a row. Recovery power cycles it through EN up to
+// EINK_RECOVERY_ATTEMPTS times, with EN held off for the given time.
+#define EINK_STUCK_TIMEOUTS 3
+#define EINK_STUCK_ERRORS 8
+#define EINK_RECOVERY_ATTEMPTS 2
+#define EINK_RECOVERY_OFF_TIME 100000
+
 #define EN_1 GPIO::GPIO_P9_16
 #define CS_1 GPIO::GPIO_P9_15
 #define BUSY_1 GPIO::GPIO_P9_25
 
 namespace PDEInkDriver {
 
+// How image packets are acknowledged
+typedef enum {
+	EINK_UPLOAD_ACKNOWLEDGED,  // read the status word after every packet
+	// Read packet N's status while sending packet N+1. The status word
+	// only ever reports the last packet, so this is as close as the
+	// controller gets to checking a frame once: no transfer is spent on
+	// status alone, and an error still resumes at the last good packet.
+	EINK_UPLOAD_PIPELINED
+} EInkUploadMode;
+
+// Progress of an image upload, tracked at packet granularity so an
+// interrupted upload can continue from the last acknowledged packet.
+struct EInkUpload {
+	unsigned char* data;  // caller owned, must stay valid until the upload completes
+	int length;           // total bytes to stream, including the header
+	int headerLength;     // bytes preceding the first pixel row
+	int stride;           // bytes between the starts of source pixel rows
+	int packetLength;
+	int x, y, w, h;       // region the pixel rows are written to
+	int acked;            // bytes acknowledged by the controller
+	bool roi;             // uploaded through an ROI instead of the data pointer
+	bool complete;
+};
+
+// Work saved by content deduplication
+struct EInkContentStats {
+	uint32_t uploads;         // uploads sent to the controller
+	uint32_t skippedUploads;  // uploads of content the controller already had
+	uint32_t shrunkUploads;   // full frames sent as a smaller ROI
+	uint64_t bytesSkipped;    // image bytes not sent
+	uint32_t updates;         // display updates sent
+	uint32_t skippedUpdates;  // updates of content already on screen
+};
+
+// Faults seen and the recoveries they caused
+struct EInkHealthStats {
+	uint32_t timeouts;          // BUSY waits that ran out
+	uint32_t errors;            // bad status words
+	uint32_t recoveries;        // recoveries started
+	uint32_t failedAttempts;    // power cycles after which the panel stayed stuck
+	uint64_t recoveryTime;      // microseconds spent recovering, in total
+	uint64_t lastRecoveryTime;  // and in the last recovery
+};
+
 class EInk44 {
 
 public:
-	EInk44(GPIO::GPIO_pin_type en = EN_1, GPIO::GPIO_pin_type cs = CS_1, GPIO::GPIO_pin_type busy = BUSY_1);
+	// power is false to skip the power up sequence, e.g. to bring up
+	// several panels together with powerSequence(). With cs set to
+	// SPI_NATIVE_CS the chip select of the spidev node frames transfers,
+	// e.g. /dev/spidev1.0 and /dev/spidev1.1 for two panels on SPI1.
+	EInk44(GPIO::GPIO_pin_type en = EN_1, GPIO::GPIO_pin_type cs = CS_1, GPIO::GPIO_pin_type busy = BUSY_1, bool power = true, const char* spidev = EINK_SPIDEV);
 	~EInk44();
 
+	static void powerSequence(EInk44** panels, int count);
+
 	void erase();
-	void update();
-	void updateFlashless();
-	void updateFlashlessInverted();
+	// Updates are skipped when nothing was uploaded since the last one
+	// and it used the same transition, unless forced or deduplication is
+	// off. A full update after flashless ones still runs, it clears ghosting.
+	void update(bool force = false);
+	void updateFlashless(bool force = false);
+	void updateFlashlessInverted(bool force = false);
+
+	// Let the update policy pick the transition for what changed
+	void updateAuto(bool force = false);
+
+	// Run a full refresh if the policy finds the panel idle with ghosting
+	// left, call from the event loop. Returns true if one was started.
+	bool refreshIfIdle();
+
+	// policy consulted by updateAuto(), every panel starts with its own
+	void setUpdatePolicy(EInkUpdatePolicy* policy);
+	EInkUpdatePolicy* updatePolicy();
 
 	void enable();
 	void disable();
 
+	// Keep what the driver knows about the panel in a state file: the
+	// content hashes, the update policy, the last update, the SPI clock,
+	// the BUSY timings and whether the panel is powered. Returns true when the file shows
+	// the panel powered in this boot with known content, so it can be
+	// used as it is; otherwise it still needs powering up. Construct
+	// with power false to decide after attaching.
+	bool attachState(const char* path);
+
+	// last update sent and when, on the panel clock
+	EInkTransition lastTransition();
+	uint64_t lastUpdateTime();
+
 	bool isBusy();
 	void waitUntilFree();
+
+	// Descriptor that becomes readable whenever processEvents() has work,
+	// for embedding the panel in an epoll or libuv loop. It combines a
+	// timer for the update window with edge events from the BUSY line.
+	int pollFd();
+
+	// Non-blocking step: consume pending timer and BUSY events, rearm the
+	// timer and return true while the panel is still busy.
+	bool processEvents();
+
+	// all waits and timeouts are measured on this clock
+	void setClock(Clock* clock);
+	Clock* clock();
 	
-	void sendImage(EInkImage& img);
-	void sendImage(XBMImage& img);
-	bool sendImage(unsigned char * buff, int length, unsigned char packetLength, int retrynum = 0);
-	bool sendImageROI(unsigned char * buff, int x, int y, int w, int h, int retrynum = 0);
+	bool sendImage(EInkImage& img);
+	bool sendImage(XBMImage& img);
+
+	// stream a frame straight out of a mapped frame store
+	bool sendImage(EInkFrameStore& store, int index);
+
+	bool sendImage(unsigned char * buff, int length, unsigned char packetLength);
+	bool sendImageROI(unsigned char * buff, int x, int y, int w, int h);
+
+	// Upload a rectangle of a larger bitmap without copying it out: rows
+	// are read in place, stride bytes apart. x and w are multiples of 8.
+	bool sendImageROI(unsigned char * buff, int stride, int x, int y, int w, int h);
+
+	// bytes per image packet for an upload of rows rowBytes long: as many
+	// whole rows as fit in MAX_PACKET_LENGTH, or a full packet for longer
+	// rows, 0 for empty ones
+	static int packetLength(int rowBytes);
+
+	// upload a rectangle of a full frame image to the same place on the panel
+	bool sendImageROI(EInkImage& img, int x, int y, int w, int h);
+
+	// continue the last upload from its last acknowledged packet
+	bool resumeUpload();
+	const EInkUpload& lastUpload();
+
+	void setUploadMode(EInkUploadMode mode);
+	EInkUploadMode uploadMode();
 
 	void copyImageROI(int x, int y, int w, int h);
 	void copyImageROI(int x, int y, int w, int h, int slot);
@@ -61,27 +207,152 @@ public:
 	void fill(bool white);
 	void fillROI(int x, int y, int w, int h, bool white);
 
+	// Uploads and updates of content the controller already holds are
+	// skipped. Content is tracked by hash, anything written to the panel
+	// behind the driver's back needs invalidateContent().
+	void setDeduplication(bool enabled);
+	bool deduplication();
+	void invalidateContent();
+	const EInkContentStats& contentStats();
+
+	// SPI clock of this panel. Transfers that come back with bad status
+	// words lower it one step at a time, down to MIN_SPI_SPEED.
+	void setSpeed(uint32_t hz);
+	uint32_t speed();
+
+	// Find the fastest clock up to max that moves probe packets without a
+	// single error, and keep one step below it as margin. The probe writes
+	// to the image buffer, so uploaded content is forgotten. Returns the
+	// clock in use afterwards.
+	uint32_t probeSpeed(uint32_t max = MAX_SPI_SPEED);
+
+	// Forget what the controller was last told (ROI, data pointer), so
+	// the next commands are all sent. Done on errors and power changes,
+	// call it after resetting the controller by other means.
+	void invalidateControllerState();
+
+	// A panel that keeps timing out or answering with errors is stuck:
+	// the command in progress gives up, and the next one first power
+	// cycles the panel and sends the last known frame again. A panel
+	// that is still stuck after that is failed, and every command on it
+	// returns at once without touching the bus, until recover() is called
+	// again. Returns true if the panel came back.
+	bool recover();
+	bool failed();
+	const EInkHealthStats& health();
+
+	// Time from sending each image packet until the controller is ready
+	// for the next one, acknowledgement included where it is read. NULL
+	// stops recording.
+	void setLatencyRecorder(LatencyRecorder* recorder);
+	LatencyRecorder* latencyRecorder();
+
+	// Lock the buffers the I/O path touches into memory: the transfer
+	// buffers and the frame kept for recovery. For real-time mode, see
+	// enterRealTime(). Returns false if the limit on locked memory is too
+	// low.
+	bool lockMemory();
+
+	// BUSY durations learned per command, which every wait sleeps by
+	// before spinning on the line. Reading BUSY is cheapest with the GPIO
+	// registers mapped, see GPIO_map_registers().
+	EInkBusyModel& busyModel();
+
+	// retry policy applied to every command answered with a status word
+	void setRetryPolicy(RetryPolicy& policy);
+	RetryPolicy& retryPolicy();
+
 private:
-	bool _sendImagePacket(unsigned char * buff, int packetNo, unsigned char packetLength, int retrynum = 0);
-	bool _sendImagePacket(unsigned char * buff, int packetNo, unsigned char packetLength, unsigned char init, int retrynum = 0);
-	bool _resetDataPointer(int retrynum = 0);
-	void _sendUpdate(unsigned char transition);
-	void _setImageROI(int x, int y, int w, int h);
+	bool _startUpload();
+	bool _sendImageData(int offset);
+	bool _sendImageDataPipelined();
+	bool _sendImagePacket(int offset, int packetNo, unsigned char packetLength);
+	void _copyPacket(unsigned char* dst, int offset, int length);
+	uint32_t _hashUpload();
+	bool _resetDataPointer();
+	void _sendUpdate(unsigned char transition, bool force);
+	void _forgetContent(int x, int y, int w, int h);
+	void _saveState(bool policy = false);
+	bool _setImageROI(int x, int y, int w, int h, bool rewind);
 	void _copyLastSlot(int slot);
 	void _uploadImageFixVal(int slot, bool white);
 
-	void _waitForBusy(int timeout);
-	int _readResponse(int tryn = 1);
+	bool _waitForBusy(int timeout, EInkBusyCommand command);
+	bool _stuck();
+	bool _checkHealth();
+	void _recordUpload();
+	bool _replayFrame();
+	int _readResponse();
+	int _parseResponse(unsigned char * response);
+	void _noteResponse(int response);
+	int _probeErrors(int packets);
 
-	unsigned char inout[1024];
+	// the transfer buffers of _spi
+	unsigned char* inout;
+	unsigned char* _status;
 	SPI* _spi;
-	bool _hasBeenInited;
+	RetryPolicy _retry;
+	EInkUpload _upload;
+	EInkUploadMode _uploadMode;
+
+	// status words seen and bad ones among them in the current window
+	int _responses;
+	int _badResponses;
+
+	// Known content of the controller's image buffer: the band hashes of
+	// the last full frame, and the ROIs written on top of it since
+	struct ContentROI {
+		int x, y, w, h;
+		uint32_t hash;
+	};
+	bool _dedup;
+	bool _bandKnown[EINK_CONTENT_BANDS];
+	uint32_t _bandHash[EINK_CONTENT_BANDS];
+	ContentROI _rois[EINK_CONTENT_MAX_ROIS];
+	int _roiCount;
+	bool _changed;  // buffer written since the last update
+	bool _shown;    // the screen shows the buffer as of the last update
+	EInkContentStats _stats;
+
+	// What the controller was last told, to leave out commands that
+	// would not change anything
+	bool _roiKnown;
+	int _roi[4];
+	bool _pointerAtStart;  // no data written since the ROI or pointer was set
+	bool _framePointer;    // pointer reset for a full frame rather than an ROI
+
+	EInkUpdatePolicy _defaultPolicy;
+	EInkUpdatePolicy* _policy;
+
+	// consecutive faults, and the frame to send after a power cycle
+	int _timeoutRun;
+	int _errorRun;
+	bool _failed;
+	bool _recovering;
+	EInkHealthStats _health;
+	EInkImage* _frame;
+	bool _frameValid;
+
+	LatencyRecorder* _latency;
+	EInkBusyModel _busyModel;
+
+	EInkPanelState _state;
+	bool _powered;
+	EInkTransition _lastTransition;
+	uint64_t _lastUpdateTime;
 
 	GPIO::GPIO_pin_type _en;
 	GPIO::GPIO_pin_type _cs;
 	GPIO::GPIO_pin_type _busy;
 
-	struct timeval last_update_time; 
+	Clock* _clock;
+	Deadline _updateMin;
+	Deadline _updateMax;
+
+	int _epoll;
+	int _timer;
+	int _busyFd;
+	void _armTimer(uint64_t us);
 
 };
 
@@ -0,0 +1,76 @@
+
+#include <string.h>
+
+#include "EInkBusyModel.h"
+
+namespace PDEInkDriver {
+
+EInkBusyModel::EInkBusyModel(){
+	reset();
+}
+
+void EInkBusyModel::reset(){
+	memset(_estimates, 0, sizeof(_estimates));
+}
+
+void EInkBusyModel::note(EInkBusyCommand command, uint64_t us){
+	if(command < 0 || command >= EINK_BUSY_COMMANDS){
+		return;
+	}
+	Estimate& e = _estimates[command];
+	if(0 == e.samples){
+		e.expected = us;
+		e.deviation = us / 2;
+	} else {
+		// gains of 1/8 and 1/4
+		int64_t error = (int64_t)us - (int64_t)e.expected;
+		uint64_t spread = (error < 0) ? -error : error;
+		e.expected = (int64_t)e.expected + error / 8;
+		e.deviation = (int64_t)e.deviation + ((int64_t)spread - (int64_t)e.deviation) / 4;
+	}
+	if(e.samples < 0xFFFFFFFF){
+		e.samples++;
+	}
+}
+
+uint64_t EInkBusyModel::sleepTime(EInkBusyCommand command){
+	if(command < 0 || command >= EINK_BUSY_COMMANDS){
+		return EINK_BUSY_LEARN_SLEEP;
+	}
+	Estimate& e = _estimates[command];
+	if(e.samples < EINK_BUSY_LEARN_SAMPLES){
+		return EINK_BUSY_LEARN_SLEEP;
+	}
+
+	// A wait that wakes after BUSY went high measures the sleep rather
+	// than the command, which pulls the estimate down until waits wake
+	// ahead of the end again
+	uint64_t lead = 2 * e.deviation + EINK_BUSY_MARGIN;
+	if(e.expected < lead + EINK_BUSY_MIN_SLEEP){
+		return EINK_BUSY_MIN_SLEEP;
+	}
+	return e.expected - lead;
+}
+
+uint64_t EInkBusyModel::spinTime(EInkBusyCommand command){
+	if(command < 0 || command >= EINK_BUSY_COMMANDS){
+		return 0;
+	}
+	Estimate& e = _estimates[command];
+	if(e.samples < EINK_BUSY_LEARN_SAMPLES){
+		return 0;
+	}
+	return 4 * e.deviation + 2 * EINK_BUSY_MARGIN;
+}
+
+const EInkBusyModel::Estimate& EInkBusyModel::estimate(EInkBusyCommand command){
+	return _estimates[(command < 0 || command >= EINK_BUSY_COMMANDS) ? 0 : command];
+}
+
+void EInkBusyModel::setEstimate(EInkBusyCommand command, const Estimate& estimate){
+	if(command >= 0 && command < EINK_BUSY_COMMANDS){
+		_estimates[command] = estimate;
+	}
+}
+
+}
@@ -0,0 +1,70 @@
+
+#ifndef EINK_BUSY_MODEL_H
+#define EINK_BUSY_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Waits sleep this long while a command is still being learned, the
+// fixed delay every wait used to start with
+#define EINK_BUSY_LEARN_SLEEP 1000
+#define EINK_BUSY_LEARN_SAMPLES 8
+
+// BUSY needs a moment to go low after a command, waits never sleep less
+#define EINK_BUSY_MIN_SLEEP 100
+
+// wake this long plus twice the deviation ahead of the expected end
+#define EINK_BUSY_MARGIN 50
+
+namespace PDEInkDriver {
+
+// Commands that are followed by a BUSY wait
+typedef enum {
+	EINK_BUSY_PACKET,    // image data packet
+	EINK_BUSY_RESPONSE,  // status word read
+	EINK_BUSY_ROI,       // set ROI
+	EINK_BUSY_FILL,      // fill with a fixed value
+	EINK_BUSY_COPY,      // slot copy
+	EINK_BUSY_POINTER,   // data pointer reset
+	EINK_BUSY_ERASE,
+	EINK_BUSY_POWER,     // controller start after power up
+	EINK_BUSY_COMMANDS,
+	EINK_BUSY_OTHER = EINK_BUSY_COMMANDS  // not learned, waits as while learning
+} EInkBusyCommand;
+
+// Learned BUSY durations, one running estimate per command: moving
+// averages of the duration and of its deviation, as TCP keeps for round
+// trip times. A wait sleeps until just before the expected end and spins
+// from there, so it neither oversleeps nor burns the CPU for long.
+class EInkBusyModel {
+
+public:
+	struct Estimate {
+		uint64_t expected;   // microseconds from the command to BUSY high
+		uint64_t deviation;  // mean deviation from that
+		uint32_t samples;
+		uint32_t reserved;
+	};
+
+	EInkBusyModel();
+
+	// a wait that ended after us microseconds, timeouts are left out
+	void note(EInkBusyCommand command, uint64_t us);
+
+	// microseconds to sleep before polling BUSY
+	uint64_t sleepTime(EInkBusyCommand command);
+
+	// microseconds to spin after that before falling back to slow polling
+	uint64_t spinTime(EInkBusyCommand command);
+
+	const Estimate& estimate(EInkBusyCommand command);
+	void setEstimate(EInkBusyCommand command, const Estimate& estimate);
+	void reset();
+
+private:
+	Estimate _estimates[EINK_BUSY_COMMANDS];
+};
+
+}
+
+#endif
@@ -0,0 +1,206 @@
+
+#include <string.h>
+#include <algorithm>
+
+#include "EInkDitherer.h"
+
+namespace PDEInkDriver {
+
+// 8x8 Bayer matrix
+static const unsigned char bayer[8][8] = {
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+EInkDitherer::EInkDitherer(EInkDitherMode mode, int threshold){
+	_mode = mode;
+	setThreshold(threshold);
+	_width = 0;
+	_row = 0;
+}
+
+EInkDitherMode EInkDitherer::mode(){
+	return _mode;
+}
+
+int EInkDitherer::threshold(){
+	return _threshold;
+}
+
+void EInkDitherer::setMode(EInkDitherMode mode){
+	_mode = mode;
+}
+
+void EInkDitherer::setThreshold(int threshold){
+	_threshold = (threshold < 1) ? 1 : (threshold > 255) ? 255 : threshold;
+}
+
+void EInkDitherer::begin(int width){
+	_width = (width < 0) ? 0 : width;
+	_row = 0;
+	int i;
+	for(i = 0; i < 3; i++){
+		_err[i].assign(_width + 4, 0);
+	}
+	_bits.assign((_width + 7) / 8, 0);
+}
+
+// bit value of a white pixel
+#if EINK_INVERSE
+#define WHITE(c) (c)
+#else
+#define WHITE(c) (!(c))
+#endif
+
+// Compare eight pixels at a time against a threshold row. No branches and
+// no carried state, so the compiler can turn the loop into vector compares.
+void EInkDitherer::_threshold8(const unsigned char* grey, const unsigned char* t, unsigned char* out, int n){
+	int i;
+	for(i = 0; i + 8 <= n; i += 8){
+		const unsigned char* g = grey + i;
+		unsigned char b =
+			((g[0] >= t[0]) << 7) | ((g[1] >= t[1]) << 6) |
+			((g[2] >= t[2]) << 5) | ((g[3] >= t[3]) << 4) |
+			((g[4] >= t[4]) << 3) | ((g[5] >= t[5]) << 2) |
+			((g[6] >= t[6]) << 1) | (g[7] >= t[7]);
+		#if EINK_INVERSE
+		out[i / 8] = b;
+		#else
+		out[i / 8] = ~b;
+		#endif
+	}
+	if(i < n){
+		unsigned char b = 0;
+		int j;
+		for(j = 0; i + j < n; j++){
+			b |= WHITE(grey[i + j] >= t[j]) << (7 - j);
+		}
+		out[i / 8] = b;
+	}
+}
+
+void EInkDitherer::_diffuse(const unsigned char* grey, unsigned char* out){
+	int* cur = &_err[0][2];
+	int* next = &_err[1][2];
+	int* next2 = &_err[2][2];
+	unsigned char b = 0;
+	int i;
+
+	if(DITHER_FLOYD_STEINBERG == _mode){
+		// errors are kept in sixteenths
+		for(i = 0; i < _width; i++){
+			int v = grey[i] + ((cur[i] + 8) >> 4);
+			int white = v >= _threshold;
+			int e = v - (white ? 255 : 0);
+			cur[i + 1] += e * 7;
+			next[i - 1] += e * 3;
+			next[i] += e * 5;
+			next[i + 1] += e;
+			b |= WHITE(white) << (7 - (i & 7));
+			if(7 == (i & 7)){
+				out[i / 8] = b;
+				b = 0;
+			}
+		}
+	} else {
+		// Atkinson spreads 6/8 of the error over two rows, in eighths
+		for(i = 0; i < _width; i++){
+			int v = grey[i] + ((cur[i] + 4) >> 3);
+			int white = v >= _threshold;
+			int e = v - (white ? 255 : 0);
+			cur[i + 1] += e;
+			cur[i + 2] += e;
+			next[i - 1] += e;
+			next[i] += e;
+			next[i + 1] += e;
+			next2[i] += e;
+			b |= WHITE(white) << (7 - (i & 7));
+			if(7 == (i & 7)){
+				out[i / 8] = b;
+				b = 0;
+			}
+		}
+	}
+	if(_width & 7){
+		out[_width / 8] = b;
+	}
+
+	// the current row is done, move the others up
+	_err[0].swap(_err[1]);
+	_err[1].swap(_err[2]);
+	std::fill(_err[2].begin(), _err[2].end(), 0);
+}
+
+void EInkDitherer::pushRow(const unsigned char* grey, unsigned char* dst, int x){
+	if(0 == _width){
+		return;
+	}
+
+	// whole bytes at a byte offset are written in place, anything else
+	// goes through the row buffer and is merged
+	bool direct = 0 == (x & 7) && 0 == (_width & 7);
+	unsigned char* out = direct ? dst + (x >> 3) : &_bits[0];
+
+	switch(_mode){
+	case DITHER_THRESHOLD: {
+		unsigned char t[8];
+		memset(t, _threshold, sizeof(t));
+		_threshold8(grey, t, out, _width);
+		break;
+	}
+	case DITHER_BAYER: {
+		// spread the matrix around the threshold, repeat it across a row
+		const unsigned char* m = bayer[_row & 7];
+		unsigned char t[8];
+		int j;
+		for(j = 0; j < 8; j++){
+			int v = _threshold + ((m[j] * 4 + 2) - 128);
+			t[j] = (v < 1) ? 1 : (v > 255) ? 255 : v;
+		}
+		_threshold8(grey, t, out, _width);
+		break;
+	}
+	default:
+		_diffuse(grey, out);
+		break;
+	}
+
+	if(!direct){
+		EInkImage::putBits(dst, x, out, _width);
+	}
+	_row++;
+}
+
+void EInkDitherer::dither(const unsigned char* grey, int width, int height, int stride, EInkImage& img, int x, int y){
+	// clip horizontally by dithering only the visible part of each row,
+	// error diffusion then starts at the clipped edge
+	int skip = (x < 0) ? -x : 0;
+	int w = width - skip;
+	if(x + width > img.width()){
+		w -= x + width - img.width();
+	}
+	if(w <= 0){
+		return;
+	}
+	begin(w);
+
+	int r;
+	for(r = 0; r < height; r++){
+		int row = y + r;
+		if(row >= img.height()){
+			break;
+		}
+		if(row < 0){
+			continue;
+		}
+		pushRow(grey + (size_t)r * stride + skip, img.row(row), x + skip);
+	}
+}
+
+}
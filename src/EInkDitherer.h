@@ -0,0 +1,65 @@
+
+#ifndef EINK_DITHERER_H
+#define EINK_DITHERER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "EInkImage.h"
+
+#define DEFAULT_DITHER_THRESHOLD 128
+
+namespace PDEInkDriver {
+
+typedef enum {
+	DITHER_THRESHOLD,
+	DITHER_BAYER,
+	DITHER_FLOYD_STEINBERG,
+	DITHER_ATKINSON
+} EInkDitherMode;
+
+// Converts 8 bit greyscale (0 black, 255 white) to packed panel bits one
+// row at a time. Output goes straight into the destination row in the
+// order the panel expects, error diffusion only keeps the error of the
+// next rows, so rows can be pushed as they are decoded.
+class EInkDitherer {
+
+public:
+	EInkDitherer(EInkDitherMode mode = DITHER_FLOYD_STEINBERG, int threshold = DEFAULT_DITHER_THRESHOLD);
+
+	EInkDitherMode mode();
+	int threshold();
+
+	void setMode(EInkDitherMode mode);
+	void setThreshold(int threshold);
+
+	// start a new image with rows of the given width
+	void begin(int width);
+
+	// dither the next row into dst, starting at pixel x of that row
+	void pushRow(const unsigned char* grey, unsigned char* dst, int x = 0);
+
+	// dither a whole buffer into the image with its top left corner at
+	// (x, y), rows that fall outside the image are skipped
+	void dither(const unsigned char* grey, int width, int height, int stride, EInkImage& img, int x = 0, int y = 0);
+
+private:
+	EInkDitherMode _mode;
+	int _threshold;
+	int _width;
+	int _row;
+
+	// diffused error of the current and the next two rows, with a margin
+	// of two pixels on either side
+	std::vector<int> _err[3];
+
+	void _threshold8(const unsigned char* grey, const unsigned char* t, unsigned char* out, int n);
+	void _diffuse(const unsigned char* grey, unsigned char* out);
+
+	std::vector<unsigned char> _bits;
+};
+
+}
+
+#endif
@@ -0,0 +1,292 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "EInkFont.h"
+
+namespace PDEInkDriver {
+
+EInkFont::EInkFont(){
+	_ascent = 0;
+	_descent = 0;
+	_top = 0;
+	_bottom = 0;
+	int i;
+	for(i = 0; i < 256; i++){
+		_index[i] = -1;
+	}
+}
+
+bool EInkFont::loadBDF(const char* path){
+	FILE* f = fopen(path, "rb");
+	if(NULL == f){
+		warn("EInkFont: cannot open %s", path);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char* data = (char*)malloc(size > 0 ? size : 1);
+	bool ok = NULL != data && size > 0 && fread(data, 1, size, f) == (size_t)size;
+	fclose(f);
+
+	ok = ok && _parse(data, size);
+	free(data);
+	return ok;
+}
+
+bool EInkFont::loadBDF(const char* data, size_t length){
+	return _parse(data, length);
+}
+
+bool EInkFont::hasGlyph(unsigned char c){
+	return _index[c] >= 0;
+}
+
+int EInkFont::ascent(){
+	return _ascent;
+}
+
+int EInkFont::descent(){
+	return _descent;
+}
+
+int EInkFont::height(){
+	return _ascent + _descent;
+}
+
+int EInkFont::top(){
+	return _top;
+}
+
+int EInkFont::bottom(){
+	return _bottom;
+}
+
+int EInkFont::textWidth(const char* text){
+	int w = 0;
+	const unsigned char* p;
+	for(p = (const unsigned char*)text; *p; p++){
+		if(_index[*p] >= 0){
+			w += _glyphs[_index[*p]].advance;
+		}
+	}
+	return w;
+}
+
+void EInkFont::draw(EInkImage& img, int x, int y, const char* text, bool white){
+	draw(img, x, y, text, white, 0, img.height());
+}
+
+void EInkFont::draw(EInkImage& img, int x, int y, const char* text, bool white, int top, int bottom){
+	if(top < 0){
+		top = 0;
+	}
+	if(bottom > img.height()){
+		bottom = img.height();
+	}
+
+	// Ink is black by default. Pixels are 1 for white, so black text
+	// clears bits and white text sets them.
+	#if EINK_INVERSE
+	bool set = white;
+	#else
+	bool set = !white;
+	#endif
+
+	int width = img.width();
+	int pen = x;
+	const unsigned char* p;
+	for(p = (const unsigned char*)text; *p; p++){
+		if(_index[*p] < 0){
+			continue;
+		}
+		Glyph& g = _glyphs[_index[*p]];
+		int gx = pen + g.x;
+		pen += g.advance;
+		if(gx >= width || gx + g.width <= 0){
+			continue;
+		}
+
+		// glyphs that stick out on the left are shifted in, dropping
+		// the columns that fall off
+		uint64_t clip = 0xFFFFFFFFull;
+		int shift = 0;
+		if(gx < 0){
+			shift = -gx;
+			gx = 0;
+		}
+		if(gx + g.width - shift > width){
+			clip &= 0xFFFFFFFFull << (32 - (width - gx) - shift);
+		}
+		int byte = gx / 8;
+		int bit = gx % 8;
+
+		int r;
+		for(r = 0; r < g.height; r++){
+			int row = y + g.y + r;
+			if(row < top || row >= bottom){
+				continue;
+			}
+
+			// the glyph row lands in up to five bytes: line it up with
+			// the destination once and apply it a byte at a time
+			uint64_t m = ((uint64_t)_atlas[g.offset + r] & clip) << shift;
+			m = (m & 0xFFFFFFFFull) << (32 - bit);
+			if(0 == m){
+				continue;
+			}
+			unsigned char* dst = img.row(row) + byte;
+			int b;
+			for(b = 0; b < 5 && byte + b < width / 8; b++){
+				unsigned char v = (unsigned char)(m >> (56 - 8 * b));
+				if(set){
+					dst[b] |= v;
+				} else {
+					dst[b] &= ~v;
+				}
+			}
+		}
+	}
+}
+
+// read the next line of the buffer into line, returning false at the end
+static bool next_line(const char*& p, const char* end, char* line, size_t size){
+	if(p >= end){
+		return false;
+	}
+	size_t n = 0;
+	while(p < end && *p != '\n'){
+		if(n + 1 < size && *p != '\r'){
+			line[n++] = *p;
+		}
+		p++;
+	}
+	if(p < end){
+		p++;
+	}
+	line[n] = '\0';
+	return true;
+}
+
+static bool keyword(const char* line, const char* key){
+	size_t n = strlen(key);
+	return 0 == strncmp(line, key, n) && (line[n] == ' ' || line[n] == '\0');
+}
+
+bool EInkFont::_parse(const char* data, size_t length){
+	const char* p = data;
+	const char* end = data + length;
+	char line[256];
+
+	int fontAscent = 0, fontDescent = 0;
+	int boxH = 0, boxY = 0;
+	int encoding = -1;
+	int advance = 0;
+	int bw = 0, bh = 0, bx = 0, by = 0;
+	bool inFont = false;
+
+	std::vector<Glyph> glyphs;
+	std::vector<uint32_t> atlas;
+	int index[256];
+	int i;
+	for(i = 0; i < 256; i++){
+		index[i] = -1;
+	}
+
+	while(next_line(p, end, line, sizeof(line))){
+		if(keyword(line, "STARTFONT")){
+			inFont = true;
+		} else if(keyword(line, "FONTBOUNDINGBOX")){
+			int w, x;
+			sscanf(line + 15, "%d %d %d %d", &w, &boxH, &x, &boxY);
+		} else if(keyword(line, "FONT_ASCENT")){
+			fontAscent = atoi(line + 11);
+		} else if(keyword(line, "FONT_DESCENT")){
+			fontDescent = atoi(line + 12);
+		} else if(keyword(line, "STARTCHAR")){
+			encoding = -1;
+			advance = 0;
+			bw = bh = bx = by = 0;
+		} else if(keyword(line, "ENCODING")){
+			encoding = atoi(line + 8);
+		} else if(keyword(line, "DWIDTH")){
+			advance = atoi(line + 6);
+		} else if(keyword(line, "BBX")){
+			sscanf(line + 3, "%d %d %d %d", &bw, &bh, &bx, &by);
+		} else if(keyword(line, "BITMAP")){
+			bool keep = encoding >= 0 && encoding < 256 && bw <= EINK_FONT_MAX_WIDTH && bh >= 0;
+			Glyph g;
+			g.advance = advance;
+			g.width = bw;
+			g.height = bh;
+			g.x = bx;
+			g.y = by;   // baseline relative for now
+			g.offset = atlas.size();
+
+			// hex rows, most significant bit leftmost like the panel
+			int r;
+			for(r = 0; r < bh && next_line(p, end, line, sizeof(line)); r++){
+				if(!keep){
+					continue;
+				}
+				uint32_t bits = 0;
+				int digits = 0;
+				const char* h;
+				for(h = line; *h && digits < 8; h++, digits++){
+					int v;
+					if(*h >= '0' && *h <= '9') v = *h - '0';
+					else if(*h >= 'A' && *h <= 'F') v = *h - 'A' + 10;
+					else if(*h >= 'a' && *h <= 'f') v = *h - 'a' + 10;
+					else break;
+					bits |= (uint32_t)v << (28 - 4 * digits);
+				}
+				if(bw < 32){
+					bits &= ~(0xFFFFFFFFu >> bw);
+				}
+				atlas.push_back(bits);
+			}
+			if(keep){
+				index[encoding] = glyphs.size();
+				glyphs.push_back(g);
+			}
+		}
+	}
+
+	if(!inFont || glyphs.empty()){
+		warnx("EInkFont: no usable glyphs");
+		return false;
+	}
+
+	if(fontAscent <= 0 && fontDescent <= 0){
+		fontAscent = boxH + boxY;
+		fontDescent = -boxY;
+	}
+
+	// turn baseline offsets into offsets from the top of the line
+	int top = 0, bottom = fontAscent + fontDescent;
+	size_t g;
+	for(g = 0; g < glyphs.size(); g++){
+		glyphs[g].y = fontAscent - (glyphs[g].y + glyphs[g].height);
+		if(glyphs[g].y < top){
+			top = glyphs[g].y;
+		}
+		if(glyphs[g].y + glyphs[g].height > bottom){
+			bottom = glyphs[g].y + glyphs[g].height;
+		}
+	}
+
+	_ascent = fontAscent;
+	_descent = fontDescent;
+	_top = top;
+	_bottom = bottom;
+	_glyphs.swap(glyphs);
+	_atlas.swap(atlas);
+	memcpy(_index, index, sizeof(_index));
+	return true;
+}
+
+}
@@ -0,0 +1,74 @@
+
+#ifndef EINK_FONT_H
+#define EINK_FONT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <vector>
+
+#include "EInkImage.h"
+
+#define EINK_FONT_MAX_WIDTH 32
+
+namespace PDEInkDriver {
+
+// 1bpp bitmap font loaded from BDF. Every glyph is rasterized once into a
+// packed atlas of 32 bit rows, most significant bit leftmost - the order
+// the panel uses - so drawing a string is a shift and a mask per glyph
+// row with no per-pixel work.
+class EInkFont {
+
+public:
+	EInkFont();
+
+	// load a BDF font from a file or from memory, glyphs wider than
+	// EINK_FONT_MAX_WIDTH and encodings above 255 are skipped
+	bool loadBDF(const char* path);
+	bool loadBDF(const char* data, size_t length);
+
+	bool hasGlyph(unsigned char c);
+
+	// line metrics in pixels
+	int ascent();
+	int descent();
+	int height();
+
+	// rows any glyph reaches above and below the line top, can go past
+	// the line box for fonts with tall accents or deep descenders
+	int top();
+	int bottom();
+
+	// advance of a string
+	int textWidth(const char* text);
+
+	// draw text with its top left corner at (x, y), in black or white
+	void draw(EInkImage& img, int x, int y, const char* text, bool white = false);
+
+	// same, limited to the image rows [top, bottom)
+	void draw(EInkImage& img, int x, int y, const char* text, bool white, int top, int bottom);
+
+private:
+	struct Glyph {
+		int advance;
+		int width;
+		int height;
+		int x;       // offset of the bitmap from the pen position
+		int y;       // offset of the top row from the top of the line
+		int offset;  // first row in the atlas
+	};
+
+	int _ascent;
+	int _descent;
+	int _top;
+	int _bottom;
+	int _index[256];             // glyph of each character, -1 if none
+	std::vector<Glyph> _glyphs;
+	std::vector<uint32_t> _atlas;
+
+	bool _parse(const char* data, size_t length);
+};
+
+}
+
+#endif
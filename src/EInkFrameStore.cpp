@@ -0,0 +1,167 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "EInkFrameStore.h"
+
+namespace PDEInkDriver {
+
+static size_t page_align(size_t n){
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (n + page - 1) / page * page;
+}
+
+EInkFrameStore::EInkFrameStore(){
+	_map = NULL;
+	_size = 0;
+	_writable = false;
+	_header = NULL;
+}
+
+EInkFrameStore::~EInkFrameStore(){
+	close();
+}
+
+bool EInkFrameStore::create(const char* path, int width, int height, int count){
+	if(width <= 0 || height <= 0 || 0 != width % 8 || count < 0){
+		warnx("EInkFrameStore: invalid geometry %dx%d", width, height);
+		return false;
+	}
+
+	// the frames get the same header an EInkImage of that size has
+	EInkImage white(width, height);
+	white.clear(true);
+
+	EInkFrameStoreHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, EINK_FRAME_STORE_MAGIC, sizeof(header.magic));
+	header.version = EINK_FRAME_STORE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.count = count;
+	header.frameLength = white.length();
+	header.frameStride = page_align(white.length());
+	header.dataOffset = page_align(sizeof(header));
+
+	int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0){
+		warn("EInkFrameStore: cannot create %s", path);
+		return false;
+	}
+	bool ok = sizeof(header) == (size_t)pwrite(fd, &header, sizeof(header), 0);
+	int i;
+	for(i = 0; ok && i < count; i++){
+		off_t offset = header.dataOffset + (off_t)i * header.frameStride;
+		ok = (ssize_t)header.frameLength == pwrite(fd, white.bits(), header.frameLength, offset);
+	}
+	// pad the last frame to a whole page
+	ok = ok && 0 == ftruncate(fd, header.dataOffset + (off_t)count * header.frameStride);
+	::close(fd);
+
+	if(!ok){
+		warn("EInkFrameStore: cannot write %s", path);
+	}
+	return ok;
+}
+
+bool EInkFrameStore::open(const char* path, bool writable){
+	close();
+
+	int fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+	if(fd < 0){
+		warn("EInkFrameStore: cannot open %s", path);
+		return false;
+	}
+	struct stat st;
+	if(0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(EInkFrameStoreHeader)){
+		warnx("EInkFrameStore: %s is too short", path);
+		::close(fd);
+		return false;
+	}
+
+	int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+	void* map = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(MAP_FAILED == map){
+		warn("EInkFrameStore: cannot map %s", path);
+		return false;
+	}
+	_map = (unsigned char*)map;
+	_size = st.st_size;
+	_writable = writable;
+	_header = (EInkFrameStoreHeader*)_map;
+
+	EInkFrameStoreHeader* h = _header;
+	bool valid = 0 == memcmp(h->magic, EINK_FRAME_STORE_MAGIC, sizeof(h->magic)) &&
+		EINK_FRAME_STORE_VERSION == h->version &&
+		h->frameLength == (uint32_t)(EINK_HEADER_LENGTH + h->width * h->height / 8) &&
+		h->frameStride >= h->frameLength &&
+		h->dataOffset >= sizeof(EInkFrameStoreHeader) &&
+		(uint64_t)h->dataOffset + (uint64_t)h->count * h->frameStride <= _size;
+	if(!valid){
+		warnx("EInkFrameStore: %s is not a valid frame store", path);
+		close();
+		return false;
+	}
+	return true;
+}
+
+void EInkFrameStore::close(){
+	if(NULL != _map){
+		munmap(_map, _size);
+	}
+	_map = NULL;
+	_size = 0;
+	_writable = false;
+	_header = NULL;
+}
+
+bool EInkFrameStore::isOpen(){
+	return NULL != _map;
+}
+
+int EInkFrameStore::count(){
+	return isOpen() ? _header->count : 0;
+}
+
+int EInkFrameStore::width(){
+	return isOpen() ? _header->width : 0;
+}
+
+int EInkFrameStore::height(){
+	return isOpen() ? _header->height : 0;
+}
+
+int EInkFrameStore::frameLength(){
+	return isOpen() ? _header->frameLength : 0;
+}
+
+unsigned char* EInkFrameStore::frame(int index){
+	if(!isOpen() || index < 0 || index >= (int)_header->count){
+		return NULL;
+	}
+	return _map + _header->dataOffset + (size_t)index * _header->frameStride;
+}
+
+bool EInkFrameStore::store(int index, EInkImage& img){
+	unsigned char* f = frame(index);
+	if(NULL == f || !_writable || img.width() != width() || img.height() != height()){
+		return false;
+	}
+	memcpy(f, img.bits(), _header->frameLength);
+	return true;
+}
+
+void EInkFrameStore::prefetch(int index){
+	unsigned char* f = frame(index);
+	if(NULL != f){
+		madvise(f, _header->frameStride, MADV_WILLNEED);
+	}
+}
+
+}
@@ -0,0 +1,75 @@
+
+#ifndef EINK_FRAME_STORE_H
+#define EINK_FRAME_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "EInkImage.h"
+
+#define EINK_FRAME_STORE_MAGIC "PDEFRAME"
+#define EINK_FRAME_STORE_VERSION 1
+
+namespace PDEInkDriver {
+
+// On-disk layout, all fields in host byte order. Frames follow at
+// dataOffset, each one frameStride bytes apart and laid out exactly like
+// EInkImage::bits(): the 16 byte panel header followed by the rows.
+struct EInkFrameStoreHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t count;
+	uint32_t frameLength;
+	uint32_t frameStride;
+	uint32_t dataOffset;
+	uint32_t reserved[7];
+};
+
+// A file of pre-rendered frames mapped into memory. A frame is a pointer
+// into the mapping that can be handed to EInk44::sendImage as it is, so
+// switching screens costs no decoding, copying or allocation. Frames
+// start on page boundaries, each one is a separate run of pages in the
+// page cache.
+class EInkFrameStore {
+
+public:
+	EInkFrameStore();
+	~EInkFrameStore();
+
+	// create a file for count frames of the given size, all white
+	static bool create(const char* path, int width, int height, int count);
+
+	// map a file, read only unless frames are to be stored
+	bool open(const char* path, bool writable = false);
+	void close();
+	bool isOpen();
+
+	int count();
+	int width();
+	int height();
+
+	// bytes of a frame including its header
+	int frameLength();
+
+	// a frame in EInkImage layout, NULL if the index is out of range
+	unsigned char* frame(int index);
+
+	// copy an image of the same size into a frame of a writable store
+	bool store(int index, EInkImage& img);
+
+	// ask the kernel to read a frame in ahead of use
+	void prefetch(int index);
+
+private:
+	unsigned char* _map;
+	size_t _size;
+	bool _writable;
+	EInkFrameStoreHeader* _header;
+};
+
+}
+
+#endif
@@ -1,3 +1,5 @@
+#include <err.h>
+#include <stdlib.h>
 
 #include "EInkImage.h"
 
@@ -6,22 +8,33 @@ namespace PDEInkDriver {
 EInkImage::EInkImage(int width, int height){
 	_width = width;
 	_height = height;
-	image = (unsigned char*)malloc(length());
+
+	// Place the header so the pixel rows begin on a cache line
+	void* storage = NULL;
+	if(0 != posix_memalign(&storage, EINK_CACHE_LINE, length() + EINK_CACHE_LINE - EINK_HEADER_LENGTH)){
+		errx(1, "EInkImage: cannot allocate a %dx%d image", width, height);
+	}
+	_storage = (unsigned char*)storage;
+	image = _storage + EINK_CACHE_LINE - EINK_HEADER_LENGTH;
 	createHeader();
 	clear();
 }
 
+EInkImage::~EInkImage(){
+	free(_storage);
+}
+
 void EInkImage::createHeader()
 {
    image[0] = 0x33;//panel type
-   image[1] = 0x01;//x res
-   image[2] = 0x90;
-   image[3] = 0x01;//y res
-   image[4] = 0x2c;
+   image[1] = (_width >> 8) & 0xFF;//x res
+   image[2] = _width & 0xFF;
+   image[3] = (_height >> 8) & 0xFF;//y res
+   image[4] = _height & 0xFF;
    image[5] = 0x01;//color depth
    image[6] = 0x00;//pixel data format - 0x02 optimized; 0x00 raw
    int i;
-   for(i = 7; i < 16; i++)
+   for(i = 7; i < EINK_HEADER_LENGTH; i++)
       image[i] = 0x00;
 }
 
@@ -29,34 +42,60 @@ unsigned char*  EInkImage::bits(){
 	return image;
 }
 
+void EInkImage::putBits(unsigned char* row, int x, const unsigned char* bits, int w){
+	int shift = x & 7;
+	row += x >> 3;
+	int n = (w + 7) / 8;
+	int i;
+	for(i = 0; i < n; i++){
+		int count = (w - i * 8 < 8) ? w - i * 8 : 8;
+		unsigned char mask = (unsigned char)(0xFF << (8 - count));
+		unsigned char v = bits[i] & mask;
+
+		// a source byte lands in two destination bytes unless aligned
+		row[i] = (row[i] & ~(mask >> shift)) | (v >> shift);
+		unsigned char spill = (unsigned char)(mask << (8 - shift));
+		if(0 != shift && 0 != spill){
+			row[i + 1] = (row[i + 1] & ~spill) | (unsigned char)(v << (8 - shift));
+		}
+	}
+}
+
+unsigned char* EInkImage::row(int y){
+	return &image[EINK_HEADER_LENGTH + y * stride()];
+}
+
 int EInkImage::length(){
-	return 16 + _width * _height / 8;
+	return EINK_HEADER_LENGTH + _width * _height / 8;
+}
+
+int EInkImage::width(){
+	return _width;
+}
+
+int EInkImage::height(){
+	return _height;
+}
+
+int EInkImage::stride(){
+	return _width / 8;
 }
 
 void EInkImage::clear(bool white){
 	if(white){
-		memset(&image[16], 0xFF, length() - 16);
+		memset(&image[EINK_HEADER_LENGTH], 0xFF, length() - EINK_HEADER_LENGTH);
 	} else {
-		memset(&image[16], 0x00, length() - 16);	
+		memset(&image[EINK_HEADER_LENGTH], 0x00, length() - EINK_HEADER_LENGTH);	
 	}
 }
 
 void EInkImage::addXBMImage(XBMImage& img){
-	addXBMImage(img, 0, 0);
+	addXBMImage(&img, 0, 0);
 }
 
 void EInkImage::addXBMImage(XBMImage& img, int start_x, int start_y)
 {
-	int y, x;
-	for(y = 0; y < img.height(); y++){
-		int row_index_src = (y * img.width()) / 8;
-		int row_index_dst = ((y + start_y) * _width + start_x) / 8;
-		for(x = 0; x < img.width() / 8; x++){
-			if(x + start_x < _width){
-				image[row_index_dst + x + 16] = img.bits()[row_index_src + x];
-			}
-		}
-	}
+	addXBMImage(&img, start_x, start_y);
 }
 
 void EInkImage::addXBMImage(XBMImage* img){
@@ -64,17 +103,69 @@ void EInkImage::addXBMImage(XBMImage* img){
 }
 
 void EInkImage::addXBMImage(XBMImage* img, int start_x, int start_y)
+{
+	addXBMImage(img, start_x, start_y, 0, _height);
+}
+
+void EInkImage::addXBMImage(XBMImage* img, int start_x, int start_y, int top, int bottom)
 {
 	int y, x;
-	for(y = 0; y < img->height(); y++){
-		int row_index_src = (y * img->width()) / 8;
-		int row_index_dst = ((y + start_y) * _width + start_x) / 8;
+	int y0 = (start_y > top) ? start_y : top;
+	int y1 = (start_y + img->height() < bottom) ? start_y + img->height() : bottom;
+	if(y1 > _height){
+		y1 = _height;
+	}
+	for(y = y0; y < y1; y++){
+		int row_index_src = ((y - start_y) * img->width()) / 8;
+		int row_index_dst = (y * _width + start_x) / 8;
 		for(x = 0; x < img->width() / 8; x++){
-			if(x + start_x < _width){
-				image[row_index_dst + x + 16] = img->bits()[row_index_src + x];
+			if(x * 8 + start_x < _width){
+				image[row_index_dst + x + EINK_HEADER_LENGTH] = img->bits()[row_index_src + x];
 			}
 		}
 	}
 }
 
-}
\ No newline at end of file
+void EInkImage::fillRect(int x, int y, int w, int h, bool white){
+	fillRect(x, y, w, h, white, 0, _height);
+}
+
+void EInkImage::fillRect(int x, int y, int w, int h, bool white, int top, int bottom){
+	int x0 = (x > 0) ? x : 0;
+	int x1 = (x + w < _width) ? x + w : _width;
+	int y0 = (y > top) ? y : top;
+	int y1 = (y + h < bottom) ? y + h : bottom;
+	if(y0 < 0){
+		y0 = 0;
+	}
+	if(y1 > _height){
+		y1 = _height;
+	}
+	if(x0 >= x1 || y0 >= y1){
+		return;
+	}
+
+	// pixels are packed MSB first, so the left edge keeps its high bits
+	int first = x0 / 8;
+	int last = (x1 - 1) / 8;
+	unsigned char head = 0xFF >> (x0 % 8);
+	unsigned char tail = 0xFF << (7 - (x1 - 1) % 8);
+	unsigned char value = white ? 0xFF : 0x00;
+
+	int r;
+	for(r = y0; r < y1; r++){
+		unsigned char* p = row(r);
+		if(first == last){
+			unsigned char mask = head & tail;
+			p[first] = (p[first] & ~mask) | (value & mask);
+			continue;
+		}
+		p[first] = (p[first] & ~head) | (value & head);
+		if(last > first + 1){
+			memset(&p[first + 1], value, last - first - 1);
+		}
+		p[last] = (p[last] & ~tail) | (value & tail);
+	}
+}
+
+}
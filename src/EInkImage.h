@@ -5,14 +5,23 @@
 
 #include "XBMImage.h"
 
+#define EINK_HEADER_LENGTH 16
+#define EINK_CACHE_LINE 64
+
 namespace PDEInkDriver {
 
 class EInkImage {
 
 public:
 	EInkImage(int width, int height);
+	~EInkImage();
 
 	int length();
+	int width();
+	int height();
+
+	// bytes per pixel row
+	int stride();
 
 	void clear(bool white = false);
 	void createHeader();
@@ -23,14 +32,34 @@ public:
 	void addXBMImage(XBMImage* img);
 	void addXBMImage(XBMImage* img, int start_x, int start_y);
 
+	void fillRect(int x, int y, int w, int h, bool white);
+
+	// Same as above, limited to the pixel rows [top, bottom) so that
+	// separate row bands can be drawn from different threads
+	void addXBMImage(XBMImage* img, int start_x, int start_y, int top, int bottom);
+	void fillRect(int x, int y, int w, int h, bool white, int top, int bottom);
+
 	unsigned char* bits();
 
+	// copy w packed pixels into a row starting at pixel x, the pixels
+	// around them are kept
+	static void putBits(unsigned char* row, int x, const unsigned char* bits, int w);
+
+	// first byte of a pixel row, rows start on a cache line when the
+	// stride is a multiple of EINK_CACHE_LINE
+	unsigned char* row(int y);
+
 private:
+	// the pixels are owned, copies are not supported
+	EInkImage(const EInkImage&);
+	EInkImage& operator=(const EInkImage&);
+
 	int _height;
 	int _width;
+	unsigned char* _storage;
 	unsigned char* image;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
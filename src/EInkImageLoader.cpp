@@ -0,0 +1,483 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#ifdef PDEINKDRIVER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "EInkImageLoader.h"
+
+namespace PDEInkDriver {
+
+static const unsigned char png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+static uint32_t read_be32(const unsigned char* p){
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+EInkImageLoader::EInkImageLoader(EInkDitherer* ditherer) : _own(DITHER_FLOYD_STEINBERG){
+	_dither = (NULL == ditherer) ? &_own : ditherer;
+	_img = NULL;
+	_x = 0;
+	_y = 0;
+	_skip = 0;
+	_visible = 0;
+}
+
+bool EInkImageLoader::info(const char* path, int* width, int* height){
+	FILE* f = fopen(path, "rb");
+	if(NULL == f){
+		warn("EInkImageLoader: cannot open %s", path);
+		return false;
+	}
+	int format, depth, colour, interlace;
+	bool ok = _readPBMHeader(f, &format, width, height);
+	if(!ok){
+		rewind(f);
+		ok = _readPNGHeader(f, width, height, &depth, &colour, &interlace);
+	}
+	fclose(f);
+	return ok;
+}
+
+bool EInkImageLoader::load(const char* path, EInkImage& img, int x, int y){
+	FILE* f = fopen(path, "rb");
+	if(NULL == f){
+		warn("EInkImageLoader: cannot open %s", path);
+		return false;
+	}
+	unsigned char magic[2] = { 0, 0 };
+	size_t n = fread(magic, 1, 2, f);
+	fclose(f);
+
+	if(2 == n && 'P' == magic[0] && ('1' == magic[1] || '4' == magic[1])){
+		return loadPBM(path, img, x, y);
+	}
+	if(2 == n && png_signature[0] == magic[0] && png_signature[1] == magic[1]){
+		return loadPNG(path, img, x, y);
+	}
+	warnx("EInkImageLoader: unknown format %s", path);
+	return false;
+}
+
+EInkImage* EInkImageLoader::load(const char* path){
+	int width, height;
+	if(!info(path, &width, &height)){
+		return NULL;
+	}
+	EInkImage* img = new EInkImage((width + 7) & ~7, height);
+	img->clear(true);
+	if(!load(path, *img, 0, 0)){
+		delete img;
+		return NULL;
+	}
+	return img;
+}
+
+bool EInkImageLoader::_begin(EInkImage& img, int x, int y, int width){
+	_img = &img;
+	_x = x;
+	_y = y;
+	_skip = (x < 0) ? -x : 0;
+	_visible = width - _skip;
+	if(x + width > img.width()){
+		_visible -= x + width - img.width();
+	}
+	if(_visible < 0){
+		_visible = 0;
+	}
+	_row.assign(width + 8, 0);
+	_dither->begin(_visible);
+	return _visible > 0;
+}
+
+bool EInkImageLoader::_wanted(int row){
+	int r = _y + row;
+	return _visible > 0 && r >= 0 && r < _img->height();
+}
+
+// Copy a row of MSB first bits, shifting out the clipped left edge and
+// inverting on the way if needed
+void EInkImageLoader::_putBits(int row, const unsigned char* bits, bool invert){
+	if(!_wanted(row)){
+		return;
+	}
+	unsigned char* out = &_row[0];
+	const unsigned char* src = bits + _skip / 8;
+	int shift = _skip & 7;
+	int n = (_visible + 7) / 8;
+	unsigned char flip = invert ? 0xFF : 0x00;
+	int i;
+	if(0 == shift){
+		for(i = 0; i < n; i++){
+			out[i] = src[i] ^ flip;
+		}
+	} else {
+		// the last source byte is only read while it holds visible pixels
+		int last = (_skip + _visible - 1) / 8 - _skip / 8;
+		for(i = 0; i < n; i++){
+			unsigned char next = (i + 1 <= last) ? src[i + 1] : 0;
+			out[i] = (unsigned char)((src[i] << shift) | (next >> (8 - shift))) ^ flip;
+		}
+	}
+	EInkImage::putBits(_img->row(_y + row), _x + _skip, out, _visible);
+}
+
+void EInkImageLoader::_putGrey(int row, const unsigned char* grey){
+	if(!_wanted(row)){
+		return;
+	}
+	_dither->pushRow(grey + _skip, _img->row(_y + row), _x + _skip);
+}
+
+// skip whitespace and comments, then read a decimal number
+static bool pbm_number(FILE* f, int* value){
+	int c = fgetc(f);
+	while(EOF != c){
+		if('#' == c){
+			while(EOF != c && '\n' != c){
+				c = fgetc(f);
+			}
+		} else if(' ' == c || '\t' == c || '\r' == c || '\n' == c){
+			c = fgetc(f);
+		} else {
+			break;
+		}
+	}
+	if(c < '0' || c > '9'){
+		return false;
+	}
+	int v = 0;
+	while(c >= '0' && c <= '9'){
+		v = v * 10 + (c - '0');
+		if(v > 65535){
+			return false;
+		}
+		c = fgetc(f);
+	}
+	// a single whitespace character ends the header of a raw file, it
+	// has been consumed here
+	*value = v;
+	return true;
+}
+
+bool EInkImageLoader::_readPBMHeader(FILE* f, int* format, int* width, int* height){
+	unsigned char magic[2];
+	if(2 != fread(magic, 1, 2, f) || 'P' != magic[0] || ('1' != magic[1] && '4' != magic[1])){
+		return false;
+	}
+	*format = magic[1] - '0';
+	return pbm_number(f, width) && pbm_number(f, height) && *width > 0 && *height > 0;
+}
+
+bool EInkImageLoader::loadPBM(const char* path, EInkImage& img, int x, int y){
+	FILE* f = fopen(path, "rb");
+	if(NULL == f){
+		warn("EInkImageLoader: cannot open %s", path);
+		return false;
+	}
+	int format, width, height;
+	if(!_readPBMHeader(f, &format, &width, &height)){
+		warnx("EInkImageLoader: %s is not a PBM file", path);
+		fclose(f);
+		return false;
+	}
+	_begin(img, x, y, width);
+
+	// PBM uses 1 for black
+	#if EINK_INVERSE
+	bool invert = true;
+	#else
+	bool invert = false;
+	#endif
+
+	int bytes = (width + 7) / 8;
+	std::vector<unsigned char> line(bytes + 1, 0);
+	bool ok = true;
+	int r;
+	for(r = 0; r < height && ok; r++){
+		if(_y + r >= img.height()){
+			break;
+		}
+		if(4 == format){
+			ok = (size_t)bytes == fread(&line[0], 1, bytes, f);
+		} else {
+			memset(&line[0], 0, bytes);
+			int i = 0;
+			while(i < width){
+				int c = fgetc(f);
+				if(EOF == c){
+					ok = false;
+					break;
+				}
+				if('0' == c || '1' == c){
+					line[i / 8] |= (c - '0') << (7 - (i & 7));
+					i++;
+				}
+			}
+		}
+		if(ok){
+			_putBits(r, &line[0], invert);
+		}
+	}
+	fclose(f);
+
+	if(!ok){
+		warnx("EInkImageLoader: %s is truncated", path);
+	}
+	return ok;
+}
+
+bool EInkImageLoader::_readPNGHeader(FILE* f, int* width, int* height, int* depth, int* colour, int* interlace){
+	unsigned char head[8 + 8 + 13];
+	if(sizeof(head) != fread(head, 1, sizeof(head), f)){
+		return false;
+	}
+	if(0 != memcmp(head, png_signature, 8) || 0 != memcmp(head + 12, "IHDR", 4) || read_be32(head + 8) != 13){
+		return false;
+	}
+	uint32_t w = read_be32(head + 16);
+	uint32_t h = read_be32(head + 20);
+	if(0 == w || 0 == h || w > 65535 || h > 65535){
+		return false;
+	}
+	*width = w;
+	*height = h;
+	*depth = head[24];
+	*colour = head[25];
+	*interlace = head[28];
+	// skip the CRC, the next chunk follows
+	return 0 == fseek(f, 4, SEEK_CUR);
+}
+
+#ifdef PDEINKDRIVER_HAVE_ZLIB
+
+static int paeth(int a, int b, int c){
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if(pa <= pb && pa <= pc){
+		return a;
+	}
+	return (pb <= pc) ? b : c;
+}
+
+// undo the filter of a scanline in place, prev is the previous unfiltered
+// line (all zero for the first one)
+static bool png_unfilter(int type, unsigned char* line, const unsigned char* prev, int length, int bpp){
+	int i;
+	switch(type){
+	case 0:
+		break;
+	case 1:
+		for(i = bpp; i < length; i++){
+			line[i] += line[i - bpp];
+		}
+		break;
+	case 2:
+		for(i = 0; i < length; i++){
+			line[i] += prev[i];
+		}
+		break;
+	case 3:
+		for(i = 0; i < length; i++){
+			int left = (i >= bpp) ? line[i - bpp] : 0;
+			line[i] += (left + prev[i]) >> 1;
+		}
+		break;
+	case 4:
+		for(i = 0; i < length; i++){
+			int left = (i >= bpp) ? line[i - bpp] : 0;
+			int upLeft = (i >= bpp) ? prev[i - bpp] : 0;
+			line[i] += paeth(left, prev[i], upLeft);
+		}
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+bool EInkImageLoader::loadPNG(const char* path, EInkImage& img, int x, int y){
+	FILE* f = fopen(path, "rb");
+	if(NULL == f){
+		warn("EInkImageLoader: cannot open %s", path);
+		return false;
+	}
+	int width, height, depth, colour, interlace;
+	if(!_readPNGHeader(f, &width, &height, &depth, &colour, &interlace)){
+		warnx("EInkImageLoader: %s is not a PNG file", path);
+		fclose(f);
+		return false;
+	}
+
+	int channels;
+	switch(colour){
+	case 0: channels = 1; break;
+	case 2: channels = 3; break;
+	case 3: channels = 1; break;
+	case 4: channels = 2; break;
+	case 6: channels = 4; break;
+	default: channels = 0; break;
+	}
+	bool packed = (depth == 1 || depth == 2 || depth == 4 || depth == 8) && (0 == colour || 3 == colour);
+	bool wide = (depth == 8 || depth == 16) && 3 != colour;
+	bool supported = channels > 0 && 0 == interlace && (packed || wide);
+	if(!supported){
+		warnx("EInkImageLoader: %s uses an unsupported PNG format", path);
+		fclose(f);
+		return false;
+	}
+
+	// 1 bit greyscale is already bilevel with 1 for white
+	bool bilevel = 0 == colour && 1 == depth;
+	#if EINK_INVERSE
+	bool invert = false;
+	#else
+	bool invert = true;
+	#endif
+
+	int length = (width * channels * depth + 7) / 8;
+	int bpp = (channels * depth + 7) / 8;
+	int sample = depth / 8;
+	std::vector<unsigned char> lines(2 * (length + 1), 0);
+	unsigned char* line = &lines[0];
+	unsigned char* prev = &lines[length + 1];
+	std::vector<unsigned char> grey(width + 8, 0);
+	unsigned char palette[256];
+	memset(palette, 0, sizeof(palette));
+
+	_begin(img, x, y, width);
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if(Z_OK != inflateInit(&z)){
+		fclose(f);
+		return false;
+	}
+	z.next_out = line;
+	z.avail_out = length + 1;
+
+	std::vector<unsigned char> chunk;
+	int row = 0;
+	bool ok = true, done = false;
+	while(ok && !done){
+		unsigned char head[8];
+		if(sizeof(head) != fread(head, 1, sizeof(head), f)){
+			ok = false;
+			break;
+		}
+		uint32_t size = read_be32(head);
+		if(size > 0x7FFFFFFF){
+			ok = false;
+			break;
+		}
+
+		if(0 == memcmp(head + 4, "IEND", 4)){
+			break;
+		}
+		if(0 != memcmp(head + 4, "IDAT", 4) && 0 != memcmp(head + 4, "PLTE", 4)){
+			ok = 0 == fseek(f, size + 4, SEEK_CUR);
+			continue;
+		}
+
+		chunk.resize(size > 0 ? size : 1);
+		if(size != fread(&chunk[0], 1, size, f) || 0 != fseek(f, 4, SEEK_CUR)){
+			ok = false;
+			break;
+		}
+
+		if(0 == memcmp(head + 4, "PLTE", 4)){
+			uint32_t i;
+			for(i = 0; i < size / 3 && i < 256; i++){
+				const unsigned char* c = &chunk[i * 3];
+				palette[i] = (c[0] * 77 + c[1] * 150 + c[2] * 29) >> 8;
+			}
+			continue;
+		}
+
+		// inflate this chunk, handing out every completed scanline
+		z.next_in = &chunk[0];
+		z.avail_in = size;
+		while(ok && !done && z.avail_in > 0){
+			int ret = inflate(&z, Z_NO_FLUSH);
+			if(Z_OK != ret && Z_STREAM_END != ret && Z_BUF_ERROR != ret){
+				ok = false;
+				break;
+			}
+			if(0 == z.avail_out){
+				ok = png_unfilter(line[0], line + 1, prev + 1, length, bpp);
+				if(!ok){
+					break;
+				}
+
+				const unsigned char* p = line + 1;
+				if(bilevel){
+					_putBits(row, p, invert);
+				} else if(_wanted(row)){
+					int i;
+					if(depth < 8){
+						int per = 8 / depth;
+						int max = (1 << depth) - 1;
+						for(i = 0; i < width; i++){
+							int v = (p[i / per] >> ((per - 1 - i % per) * depth)) & max;
+							grey[i] = (3 == colour) ? palette[v] : v * 255 / max;
+						}
+					} else if(3 == colour){
+						for(i = 0; i < width; i++){
+							grey[i] = palette[p[i]];
+						}
+					} else {
+						// the high byte of 16 bit samples is enough here
+						int step = channels * sample;
+						for(i = 0; i < width; i++){
+							const unsigned char* s = p + i * step;
+							int v = (channels >= 3) ? (s[0] * 77 + s[sample] * 150 + s[2 * sample] * 29) >> 8 : s[0];
+							if(2 == channels || 4 == channels){
+								// composite over white
+								int a = s[(channels - 1) * sample];
+								v = (v * a + 255 * (255 - a)) / 255;
+							}
+							grey[i] = v;
+						}
+					}
+					_putGrey(row, &grey[0]);
+				}
+
+				unsigned char* t = prev;
+				prev = line;
+				line = t;
+				z.next_out = line;
+				z.avail_out = length + 1;
+				row++;
+				done = row >= height || _y + row >= img.height();
+			}
+			if(Z_STREAM_END == ret){
+				break;
+			}
+		}
+	}
+	inflateEnd(&z);
+	fclose(f);
+
+	// IEND or the end of the data before the last row
+	if(!done){
+		ok = false;
+	}
+	if(!ok){
+		warnx("EInkImageLoader: %s is corrupt or truncated", path);
+	}
+	return ok;
+}
+
+#else
+
+bool EInkImageLoader::loadPNG(const char* path, EInkImage&, int, int){
+	warnx("EInkImageLoader: built without zlib, cannot load %s", path);
+	return false;
+}
+
+#endif
+
+}
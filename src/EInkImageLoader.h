@@ -0,0 +1,67 @@
+
+#ifndef EINK_IMAGE_LOADER_H
+#define EINK_IMAGE_LOADER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "EInkImage.h"
+#include "EInkDitherer.h"
+
+namespace PDEInkDriver {
+
+// Runtime loader for PBM (P1 and P4) and PNG files. Files are decoded a
+// row at a time straight into an EInkImage. Bilevel rows are converted
+// to panel bit order while they are copied, everything else is reduced
+// to greyscale and goes through an EInkDitherer, so no full size
+// intermediate bitmap is ever allocated.
+//
+// PNG support needs zlib (PDEINKDRIVER_HAVE_ZLIB). Interlaced PNGs are not
+// supported.
+class EInkImageLoader {
+
+public:
+	// greyscale images are dithered with the given ditherer, or with
+	// Floyd-Steinberg if there is none
+	EInkImageLoader(EInkDitherer* ditherer = NULL);
+
+	// size of the image in a file without decoding it
+	bool info(const char* path, int* width, int* height);
+
+	// decode a file into the image with its top left corner at (x, y),
+	// the format is taken from the file contents
+	bool load(const char* path, EInkImage& img, int x = 0, int y = 0);
+
+	// decode a file into a new white image of the same size, the width
+	// is rounded up to whole bytes. Returns NULL on error.
+	EInkImage* load(const char* path);
+
+	bool loadPBM(const char* path, EInkImage& img, int x = 0, int y = 0);
+	bool loadPNG(const char* path, EInkImage& img, int x = 0, int y = 0);
+
+private:
+	EInkDitherer _own;
+	EInkDitherer* _dither;
+
+	// destination of the rows being decoded
+	EInkImage* _img;
+	int _x;
+	int _y;
+	int _skip;
+	int _visible;
+	std::vector<unsigned char> _row;
+
+	bool _begin(EInkImage& img, int x, int y, int width);
+	bool _wanted(int row);
+	void _putBits(int row, const unsigned char* bits, bool invert);
+	void _putGrey(int row, const unsigned char* grey);
+
+	bool _readPBMHeader(FILE* f, int* format, int* width, int* height);
+	bool _readPNGHeader(FILE* f, int* width, int* height, int* depth, int* colour, int* interlace);
+};
+
+}
+
+#endif
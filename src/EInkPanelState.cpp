@@ -0,0 +1,136 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "EInkPanelState.h"
+
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+namespace PDEInkDriver {
+
+// Empty when it cannot be read, which no payload is ever current for
+static const char* boot_id(){
+	static char id[40];
+	static bool read = false;
+	if(!read){
+		FILE* f = fopen(BOOT_ID_PATH, "r");
+		if(NULL != f){
+			if(NULL == fgets(id, sizeof(id), f)){
+				id[0] = 0;
+			}
+			fclose(f);
+		}
+		id[strcspn(id, "\n")] = 0;
+		read = true;
+	}
+	return id;
+}
+
+EInkPanelState::EInkPanelState(){
+	_map = NULL;
+	_size = 0;
+	_header = NULL;
+}
+
+EInkPanelState::~EInkPanelState(){
+	close();
+}
+
+bool EInkPanelState::open(const char* path, size_t length){
+	close();
+
+	int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0){
+		warn("EInkPanelState: cannot open %s", path);
+		return false;
+	}
+	size_t size = sizeof(EInkPanelStateHeader) + length;
+	struct stat st;
+	bool resized = false;
+	if(0 != fstat(fd, &st) || (size_t)st.st_size != size){
+		if(0 != ftruncate(fd, size)){
+			warn("EInkPanelState: cannot size %s", path);
+			::close(fd);
+			return false;
+		}
+		resized = true;
+	}
+
+	void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(MAP_FAILED == map){
+		warn("EInkPanelState: cannot map %s", path);
+		return false;
+	}
+	_map = (unsigned char*)map;
+	_size = size;
+	_header = (EInkPanelStateHeader*)_map;
+
+	EInkPanelStateHeader* h = _header;
+	bool matches = !resized &&
+		0 == memcmp(h->magic, EINK_PANEL_STATE_MAGIC, sizeof(h->magic)) &&
+		EINK_PANEL_STATE_VERSION == h->version &&
+		h->length == length;
+	if(!matches){
+		memset(_map, 0, _size);
+		memcpy(h->magic, EINK_PANEL_STATE_MAGIC, sizeof(h->magic));
+		h->version = EINK_PANEL_STATE_VERSION;
+		h->length = length;
+	}
+	return true;
+}
+
+void EInkPanelState::close(){
+	if(NULL != _map){
+		munmap(_map, _size);
+	}
+	_map = NULL;
+	_size = 0;
+	_header = NULL;
+}
+
+bool EInkPanelState::isOpen(){
+	return NULL != _map;
+}
+
+bool EInkPanelState::valid(){
+	return isOpen() && 0 != _header->sequence && 0 == (_header->sequence & 1);
+}
+
+bool EInkPanelState::current(){
+	return valid() && 0 != boot_id()[0] && 0 == strncmp(_header->bootId, boot_id(), sizeof(_header->bootId));
+}
+
+unsigned char* EInkPanelState::data(){
+	return isOpen() ? _map + sizeof(EInkPanelStateHeader) : NULL;
+}
+
+size_t EInkPanelState::length(){
+	return isOpen() ? _header->length : 0;
+}
+
+void EInkPanelState::begin(){
+	if(!isOpen()){
+		return;
+	}
+	// torn from here until commit(), whatever order the stores land in
+	_header->sequence |= 1;
+	__sync_synchronize();
+}
+
+void EInkPanelState::commit(){
+	if(!isOpen()){
+		return;
+	}
+	strncpy(_header->bootId, boot_id(), sizeof(_header->bootId) - 1);
+	__sync_synchronize();
+	// even again, skipping the 0 of a payload never written
+	_header->sequence += (0xFFFFFFFF == _header->sequence) ? 3 : 1;
+}
+
+}
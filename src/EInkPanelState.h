@@ -0,0 +1,65 @@
+
+#ifndef EINK_PANEL_STATE_H
+#define EINK_PANEL_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define EINK_PANEL_STATE_MAGIC "PDESTATE"
+#define EINK_PANEL_STATE_VERSION 1
+
+namespace PDEInkDriver {
+
+// On-disk layout, all fields in host byte order. The payload follows the
+// header directly, its layout is up to the owner.
+struct EInkPanelStateHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t length;    // payload bytes
+	uint32_t sequence;  // odd while the payload is written, 0 if it never was
+	uint32_t reserved0;
+	char bootId[40];    // boot the payload was last written in
+	uint32_t reserved[6];
+};
+
+// A small file mapped into memory that outlives the process using it. A
+// process that dies halfway through a change leaves the payload marked
+// as torn, and the boot it was written in tells whether the hardware can
+// still be in the state it describes. Changes reach the page cache as
+// they are made, so a crash loses nothing; only a power cut can, and the
+// panel does not keep its state across one either.
+class EInkPanelState {
+
+public:
+	EInkPanelState();
+	~EInkPanelState();
+
+	// map the file with room for length payload bytes, creating it or
+	// starting it over when it does not hold a payload of that length
+	bool open(const char* path, size_t length);
+	void close();
+	bool isOpen();
+
+	// the payload was written completely, in any boot
+	bool valid();
+
+	// and in the current boot
+	bool current();
+
+	unsigned char* data();
+	size_t length();
+
+	// bracket every change to the payload
+	void begin();
+	void commit();
+
+private:
+	unsigned char* _map;
+	size_t _size;
+	EInkPanelStateHeader* _header;
+};
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+
+#include "EInkTiledCanvas.h"
+
+namespace PDEInkDriver {
+
+// rows needed for a band to cover a whole number of cache lines
+static int aligned_rows(int stride){
+	int a = stride, b = EINK_CACHE_LINE;
+	while(b != 0){
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return (a > 0) ? EINK_CACHE_LINE / a : 1;
+}
+
+EInkTiledCanvas::EInkTiledCanvas(EInkImage& image, ThreadPool* pool) : _image(image){
+	_pool = pool;
+	_bandHeight = aligned_rows(image.stride());
+
+	// keep at least a few bands per thread so stealing can even out
+	// uneven work, but no more than needed
+	int threads = (NULL == _pool) ? 1 : _pool->workers() + 1;
+	int target = threads * 4;
+	while(image.height() / (_bandHeight * 2) >= target){
+		_bandHeight *= 2;
+	}
+}
+
+EInkImage& EInkTiledCanvas::image(){
+	return _image;
+}
+
+int EInkTiledCanvas::bands(){
+	return (_image.height() + _bandHeight - 1) / _bandHeight;
+}
+
+int EInkTiledCanvas::bandHeight(){
+	return _bandHeight;
+}
+
+void EInkTiledCanvas::clear(bool white){
+	fillRect(0, 0, _image.width(), _image.height(), white);
+}
+
+void EInkTiledCanvas::fillRect(int x, int y, int w, int h, bool white){
+	Op op;
+	op.type = OP_FILL;
+	op.x = x;
+	op.y = y;
+	op.w = w;
+	op.h = h;
+	op.white = white;
+	op.img = NULL;
+	op.font = NULL;
+	_ops.push_back(op);
+}
+
+void EInkTiledCanvas::addXBMImage(XBMImage& img, int x, int y){
+	Op op;
+	op.type = OP_XBM;
+	op.x = x;
+	op.y = y;
+	op.w = img.width();
+	op.h = img.height();
+	op.white = false;
+	op.img = &img;
+	op.font = NULL;
+	_ops.push_back(op);
+}
+
+void EInkTiledCanvas::drawText(EInkFont& font, int x, int y, const char* text, bool white){
+	Op op;
+	op.type = OP_TEXT;
+	op.x = x;
+	op.y = y + font.top();
+	op.w = font.textWidth(text);
+	op.h = font.bottom() - font.top();
+	op.white = white;
+	op.img = NULL;
+	op.font = &font;
+	op.text = text;
+	_ops.push_back(op);
+}
+
+void EInkTiledCanvas::flush(){
+	if(_ops.empty()){
+		return;
+	}
+
+	_bands.resize(bands());
+	size_t i;
+	for(i = 0; i < _bands.size(); i++){
+		_bands[i].canvas = this;
+		_bands[i].top = i * _bandHeight;
+		_bands[i].bottom = _bands[i].top + _bandHeight;
+		if(_bands[i].bottom > _image.height()){
+			_bands[i].bottom = _image.height();
+		}
+
+		if(NULL == _pool){
+			_drawBand(&_bands[i]);
+		} else {
+			_pool->submit(_drawBand, &_bands[i]);
+		}
+	}
+	if(NULL != _pool){
+		_pool->wait();
+	}
+	_ops.clear();
+}
+
+void EInkTiledCanvas::_draw(Op& op, int top, int bottom){
+	switch(op.type){
+	case OP_FILL:
+		_image.fillRect(op.x, op.y, op.w, op.h, op.white, top, bottom);
+		break;
+	case OP_XBM:
+		_image.addXBMImage(op.img, op.x, op.y, top, bottom);
+		break;
+	case OP_TEXT:
+		op.font->draw(_image, op.x, op.y - op.font->top(), op.text.c_str(), op.white, top, bottom);
+		break;
+	}
+}
+
+void EInkTiledCanvas::_drawBand(void* arg){
+	Band* band = (Band*)arg;
+	EInkTiledCanvas* canvas = band->canvas;
+	size_t i;
+	for(i = 0; i < canvas->_ops.size(); i++){
+		Op& op = canvas->_ops[i];
+		// skip operations that miss the band entirely
+		if(op.y >= band->bottom || op.y + op.h <= band->top){
+			continue;
+		}
+		canvas->_draw(op, band->top, band->bottom);
+	}
+}
+
+}
@@ -0,0 +1,75 @@
+
+#ifndef EINK_TILED_CANVAS_H
+#define EINK_TILED_CANVAS_H
+
+#include <string>
+#include <vector>
+
+#include "EInkImage.h"
+#include "EInkFont.h"
+#include "ThreadPool.h"
+
+namespace PDEInkDriver {
+
+// Records draw operations on an EInkImage and replays them band by band
+// across a ThreadPool. The frame is cut into horizontal bands whose byte
+// ranges start and end on cache lines, so no two threads ever write the
+// same line. Operations keep their order inside each band, which gives
+// the same result as drawing them one after another.
+class EInkTiledCanvas {
+
+public:
+	EInkTiledCanvas(EInkImage& image, ThreadPool* pool = ThreadPool::shared());
+
+	EInkImage& image();
+
+	int bands();
+	int bandHeight();
+
+	void clear(bool white);
+	void fillRect(int x, int y, int w, int h, bool white);
+	void addXBMImage(XBMImage& img, int x, int y);
+
+	// the text is copied, the font has to outlive the next flush
+	void drawText(EInkFont& font, int x, int y, const char* text, bool white = false);
+
+	// draw everything recorded so far and wait for it
+	void flush();
+
+protected:
+	typedef enum {
+		OP_FILL,
+		OP_XBM,
+		OP_TEXT
+	} OpType;
+
+	struct Op {
+		OpType type;
+		int x, y, w, h;
+		bool white;
+		XBMImage* img;
+		EInkFont* font;
+		std::string text;
+	};
+
+	struct Band {
+		EInkTiledCanvas* canvas;
+		int top;
+		int bottom;
+	};
+
+	virtual void _draw(Op& op, int top, int bottom);
+
+private:
+	EInkImage& _image;
+	ThreadPool* _pool;
+	int _bandHeight;
+	std::vector<Op> _ops;
+	std::vector<Band> _bands;
+
+	static void _drawBand(void* arg);
+};
+
+}
+
+#endif
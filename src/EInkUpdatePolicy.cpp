@@ -0,0 +1,292 @@
+
+#include <string.h>
+
+#include "EInkUpdatePolicy.h"
+
+namespace PDEInkDriver {
+
+EInkUpdatePolicy::EInkUpdatePolicy(int width, int height, int tile){
+	_width = width;
+	_height = height;
+	_tile = (tile < 8) ? 8 : tile;
+	_cols = (_width + _tile - 1) / _tile;
+	_rows = (_height + _tile - 1) / _tile;
+	_budget = DEFAULT_GHOST_BUDGET;
+	_maxPartials = DEFAULT_MAX_PARTIAL_UPDATES;
+	_idleDelay = DEFAULT_IDLE_REFRESH_DELAY;
+	_lastUpdate = 0;
+	_dirty = false;
+
+	Tile t = { 0.0, 0.0, 0, 0, false };
+	_tiles.assign(_cols * _rows, t);
+	int tx, ty;
+	for(ty = 0; ty < _rows; ty++){
+		for(tx = 0; tx < _cols; tx++){
+			int w = (_width - tx * _tile < _tile) ? _width - tx * _tile : _tile;
+			int h = (_height - ty * _tile < _tile) ? _height - ty * _tile : _tile;
+			_tiles[ty * _cols + tx].area = w * h;
+		}
+	}
+	_shadow.assign(_width / 8 * _height, 0);
+
+	// rough figures for the 4.41" panel
+	setCost(EINK_UPDATE_FLASHLESS, 300000, 0.2);
+	setCost(EINK_UPDATE_FLASHLESS_INVERTED, 600000, 0.1);
+	setCost(EINK_UPDATE_FULL, 1500000, 0.0);
+}
+
+EInkUpdatePolicy::Cost& EInkUpdatePolicy::_cost(EInkTransition transition){
+	switch(transition){
+	case EINK_UPDATE_FLASHLESS:
+		return _costs[0];
+	case EINK_UPDATE_FLASHLESS_INVERTED:
+		return _costs[1];
+	default:
+		return _costs[2];
+	}
+}
+
+EInkUpdatePolicy::Tile& EInkUpdatePolicy::_tileAt(int x, int y){
+	return _tiles[(y / _tile) * _cols + x / _tile];
+}
+
+void EInkUpdatePolicy::setCost(EInkTransition transition, uint64_t latency, double ghost){
+	Cost& c = _cost(transition);
+	c.latency = latency;
+	c.ghost = (ghost < 0) ? 0 : ghost;
+}
+
+uint64_t EInkUpdatePolicy::latency(EInkTransition transition){
+	return _cost(transition).latency;
+}
+
+double EInkUpdatePolicy::ghost(EInkTransition transition){
+	return _cost(transition).ghost;
+}
+
+void EInkUpdatePolicy::setBudget(double budget){
+	_budget = budget;
+}
+
+double EInkUpdatePolicy::budget(){
+	return _budget;
+}
+
+void EInkUpdatePolicy::setMaxPartialUpdates(int count){
+	_maxPartials = count;
+}
+
+int EInkUpdatePolicy::maxPartialUpdates(){
+	return _maxPartials;
+}
+
+void EInkUpdatePolicy::setIdleRefreshDelay(uint64_t us){
+	_idleDelay = us;
+}
+
+uint64_t EInkUpdatePolicy::idleRefreshDelay(){
+	return _idleDelay;
+}
+
+void EInkUpdatePolicy::noteUpload(int x, int y, int w, int h, const unsigned char* data, int stride){
+	int stride0 = _width / 8;
+	int x0 = (x < 0) ? 0 : x / 8;
+	int x1 = (x + w > _width) ? stride0 : (x + w) / 8;
+	int r, b;
+	for(r = 0; r < h; r++){
+		int row = y + r;
+		if(row < 0 || row >= _height){
+			continue;
+		}
+		const unsigned char* src = data + (size_t)r * stride - x / 8;
+		unsigned char* dst = &_shadow[row * stride0];
+		for(b = x0; b < x1; b++){
+			Tile& t = _tileAt(b * 8, row);
+			int changed = t.unknown ? 8 : __builtin_popcount(src[b] ^ dst[b]);
+			if(changed){
+				t.pending += (double)changed / t.area;
+				dst[b] = src[b];
+				_dirty = true;
+			}
+		}
+	}
+
+	// the shadow is right again for tiles written in full
+	int tx, ty;
+	for(ty = 0; ty < _rows; ty++){
+		for(tx = 0; tx < _cols; tx++){
+			Tile& t = _tiles[ty * _cols + tx];
+			int left = tx * _tile, top = ty * _tile;
+			int right = (left + _tile > _width) ? _width : left + _tile;
+			int bottom = (top + _tile > _height) ? _height : top + _tile;
+			if(t.unknown && x <= left && x + w >= right && y <= top && y + h >= bottom){
+				t.unknown = false;
+			}
+		}
+	}
+}
+
+void EInkUpdatePolicy::noteUnknown(int x, int y, int w, int h){
+	int tx, ty;
+	for(ty = 0; ty < _rows; ty++){
+		for(tx = 0; tx < _cols; tx++){
+			int left = tx * _tile, top = ty * _tile;
+			if(left < x + w && x < left + _tile && top < y + h && y < top + _tile){
+				// assume the worst for anything we cannot see
+				_tiles[ty * _cols + tx].pending = 1.0;
+				_tiles[ty * _cols + tx].unknown = true;
+				_dirty = true;
+			}
+		}
+	}
+}
+
+void EInkUpdatePolicy::noteUpdate(EInkTransition transition, uint64_t now){
+	Cost& c = _cost(transition);
+	size_t i;
+	for(i = 0; i < _tiles.size(); i++){
+		Tile& t = _tiles[i];
+		if(EINK_UPDATE_FULL == transition){
+			t.ghost = 0.0;
+			t.partials = 0;
+		} else if(t.pending > 0){
+			double p = (t.pending > 1.0) ? 1.0 : t.pending;
+			t.ghost += p * c.ghost;
+			t.partials++;
+		}
+		t.pending = 0.0;
+	}
+	_lastUpdate = now;
+	_dirty = false;
+}
+
+EInkTransition EInkUpdatePolicy::choose(){
+	EInkTransition candidates[2] = { EINK_UPDATE_FLASHLESS, EINK_UPDATE_FLASHLESS_INVERTED };
+	if(latency(candidates[1]) < latency(candidates[0])){
+		candidates[0] = EINK_UPDATE_FLASHLESS_INVERTED;
+		candidates[1] = EINK_UPDATE_FLASHLESS;
+	}
+
+	int c;
+	for(c = 0; c < 2; c++){
+		Cost& cost = _cost(candidates[c]);
+		if(cost.latency >= latency(EINK_UPDATE_FULL)){
+			continue;
+		}
+		bool fits = true;
+		size_t i;
+		for(i = 0; i < _tiles.size() && fits; i++){
+			Tile& t = _tiles[i];
+			if(t.pending <= 0){
+				continue;
+			}
+			double p = (t.pending > 1.0) ? 1.0 : t.pending;
+			fits = t.ghost + p * cost.ghost <= _budget && t.partials < _maxPartials;
+		}
+		if(fits){
+			return candidates[c];
+		}
+	}
+	return EINK_UPDATE_FULL;
+}
+
+bool EInkUpdatePolicy::idleRefreshDue(uint64_t now){
+	if(0 == _idleDelay || _dirty || now - _lastUpdate < _idleDelay){
+		return false;
+	}
+	return ghosting() > 0;
+}
+
+double EInkUpdatePolicy::ghosting(){
+	double worst = 0;
+	size_t i;
+	for(i = 0; i < _tiles.size(); i++){
+		if(_tiles[i].ghost > worst){
+			worst = _tiles[i].ghost;
+		}
+	}
+	return worst;
+}
+
+double EInkUpdatePolicy::pendingChange(){
+	double sum = 0;
+	size_t i;
+	for(i = 0; i < _tiles.size(); i++){
+		sum += (_tiles[i].pending > 1.0) ? 1.0 : _tiles[i].pending;
+	}
+	return sum / _tiles.size();
+}
+
+// Block layout: geometry, last update, the tiles, the shadow
+struct EInkPolicyState {
+	int32_t width;
+	int32_t height;
+	int32_t tile;
+	int32_t dirty;
+	uint64_t lastUpdate;
+};
+
+struct EInkPolicyTileState {
+	double ghost;
+	double pending;
+	int32_t partials;
+	int32_t unknown;
+};
+
+size_t EInkUpdatePolicy::stateLength(){
+	return sizeof(EInkPolicyState) + _tiles.size() * sizeof(EInkPolicyTileState) + _shadow.size();
+}
+
+void EInkUpdatePolicy::saveState(unsigned char* dst){
+	EInkPolicyState s;
+	memset(&s, 0, sizeof(s));
+	s.width = _width;
+	s.height = _height;
+	s.tile = _tile;
+	s.dirty = _dirty;
+	s.lastUpdate = _lastUpdate;
+	memcpy(dst, &s, sizeof(s));
+	dst += sizeof(s);
+
+	size_t i;
+	for(i = 0; i < _tiles.size(); i++){
+		EInkPolicyTileState t;
+		memset(&t, 0, sizeof(t));
+		t.ghost = _tiles[i].ghost;
+		t.pending = _tiles[i].pending;
+		t.partials = _tiles[i].partials;
+		t.unknown = _tiles[i].unknown;
+		memcpy(dst, &t, sizeof(t));
+		dst += sizeof(t);
+	}
+	memcpy(dst, &_shadow[0], _shadow.size());
+}
+
+bool EInkUpdatePolicy::restoreState(const unsigned char* src, size_t length){
+	EInkPolicyState s;
+	if(length != stateLength()){
+		return false;
+	}
+	memcpy(&s, src, sizeof(s));
+	if(s.width != _width || s.height != _height || s.tile != _tile){
+		return false;
+	}
+	src += sizeof(s);
+	_dirty = 0 != s.dirty;
+	_lastUpdate = s.lastUpdate;
+
+	size_t i;
+	for(i = 0; i < _tiles.size(); i++){
+		EInkPolicyTileState t;
+		memcpy(&t, src, sizeof(t));
+		src += sizeof(t);
+		_tiles[i].ghost = t.ghost;
+		_tiles[i].pending = t.pending;
+		_tiles[i].partials = t.partials;
+		_tiles[i].unknown = 0 != t.unknown;
+	}
+	memcpy(&_shadow[0], src, _shadow.size());
+	return true;
+}
+
+}
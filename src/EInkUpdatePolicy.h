@@ -0,0 +1,119 @@
+
+#ifndef EINK_UPDATE_POLICY_H
+#define EINK_UPDATE_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#include "globals.h"
+
+#define DEFAULT_POLICY_TILE 50
+#define DEFAULT_GHOST_BUDGET 1.0
+#define DEFAULT_MAX_PARTIAL_UPDATES 12
+#define DEFAULT_IDLE_REFRESH_DELAY 60000000ULL
+
+namespace PDEInkDriver {
+
+// Display update commands, named after the transition they drive
+typedef enum {
+	EINK_UPDATE_FULL = 0x24,
+	EINK_UPDATE_FLASHLESS = 0x85,
+	EINK_UPDATE_FLASHLESS_INVERTED = 0x86
+} EInkTransition;
+
+// Picks the display update for the content that changed since the last
+// one. The panel is split into tiles, each carrying a ghosting score that
+// grows with the share of its pixels changed by every flashless update
+// and drops to zero on a full update. The cheapest transition that keeps
+// every tile within the ghosting budget wins, and tiles that had too many
+// partial updates force a full one. Scores are estimates: the default
+// costs are coarse and meant to be tuned per installation.
+class EInkUpdatePolicy {
+
+public:
+	EInkUpdatePolicy(int width = EINK_WIDTH, int height = EINK_HEIGHT, int tile = DEFAULT_POLICY_TILE);
+
+	// latency in microseconds and ghosting added per fully changed tile,
+	// full updates always clear the ghosting
+	void setCost(EInkTransition transition, uint64_t latency, double ghost);
+	uint64_t latency(EInkTransition transition);
+	double ghost(EInkTransition transition);
+
+	void setBudget(double budget);
+	double budget();
+	void setMaxPartialUpdates(int count);
+	int maxPartialUpdates();
+
+	// refresh after the panel has been idle this long with any ghosting
+	// left, 0 disables idle refreshes
+	void setIdleRefreshDelay(uint64_t us);
+	uint64_t idleRefreshDelay();
+
+	// rows of the image buffer written, x and w in multiples of 8
+	void noteUpload(int x, int y, int w, int h, const unsigned char* data, int stride);
+
+	// region written with content the policy cannot see, every pixel
+	// written to its tiles counts as changed until an upload covers them
+	void noteUnknown(int x, int y, int w, int h);
+
+	// an update was sent at the given time
+	void noteUpdate(EInkTransition transition, uint64_t now);
+
+	// transition for what changed since the last update
+	EInkTransition choose();
+
+	// true when a full refresh is worth doing now because the panel has
+	// been idle long enough and some ghosting has built up
+	bool idleRefreshDue(uint64_t now);
+
+	// worst ghosting score over all tiles
+	double ghosting();
+
+	// share of pixels changed since the last update, 0 to 1
+	double pendingChange();
+
+	// What the policy has learned about the panel, the tiles and the
+	// content written, as a flat block to keep across restarts. Restoring
+	// fails for a block saved by a policy of another geometry. Costs and
+	// limits are configuration and not part of it.
+	size_t stateLength();
+	void saveState(unsigned char* dst);
+	bool restoreState(const unsigned char* src, size_t length);
+
+private:
+	struct Cost {
+		uint64_t latency;
+		double ghost;
+	};
+	struct Tile {
+		double ghost;      // accumulated ghosting
+		double pending;    // share of pixels changed since the last update
+		int partials;      // flashless updates since the last full one
+		int area;          // pixels, smaller for tiles at the edges
+		bool unknown;      // the shadow does not match the content
+	};
+
+	int _width;
+	int _height;
+	int _tile;
+	int _cols;
+	int _rows;
+	double _budget;
+	int _maxPartials;
+	uint64_t _idleDelay;
+	uint64_t _lastUpdate;
+	bool _dirty;
+	Cost _costs[3];
+	std::vector<Tile> _tiles;
+
+	// last content written to each pixel, to count what changes
+	std::vector<unsigned char> _shadow;
+
+	Cost& _cost(EInkTransition transition);
+	Tile& _tileAt(int x, int y);
+};
+
+}
+
+#endif
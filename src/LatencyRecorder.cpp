@@ -0,0 +1,51 @@
+
+#include <algorithm>
+
+#include "LatencyRecorder.h"
+
+namespace PDEInkDriver {
+
+LatencyRecorder::LatencyRecorder(int capacity){
+	_samples.assign((capacity < 1) ? 1 : capacity, 0);
+	_next = 0;
+	_count = 0;
+}
+
+void LatencyRecorder::record(uint64_t us){
+	_samples[_next] = us;
+	_next = (_next + 1) % _samples.size();
+	if(_count < (int)_samples.size()){
+		_count++;
+	}
+}
+
+void LatencyRecorder::reset(){
+	_next = 0;
+	_count = 0;
+}
+
+int LatencyRecorder::count(){
+	return _count;
+}
+
+uint64_t LatencyRecorder::percentile(double p){
+	if(0 == _count){
+		return 0;
+	}
+	std::vector<uint64_t> sorted(_samples.begin(), _samples.begin() + _count);
+	int rank = (int)(p * _count);
+	if(rank >= _count){
+		rank = _count - 1;
+	}
+	if(rank < 0){
+		rank = 0;
+	}
+	std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	return sorted[rank];
+}
+
+uint64_t LatencyRecorder::max(){
+	return percentile(1.0);
+}
+
+}
@@ -0,0 +1,39 @@
+
+#ifndef LATENCY_RECORDER_H
+#define LATENCY_RECORDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vector>
+
+#define DEFAULT_LATENCY_SAMPLES 16384
+
+namespace PDEInkDriver {
+
+// Keeps the last samples of a latency, in microseconds, for percentiles.
+// Storage is allocated up front, so recording never allocates and can sit
+// in the I/O path.
+class LatencyRecorder {
+
+public:
+	LatencyRecorder(int capacity = DEFAULT_LATENCY_SAMPLES);
+
+	void record(uint64_t us);
+	void reset();
+
+	// samples kept, at most the capacity
+	int count();
+
+	// value below which the share p of the samples lie, 0 without any
+	uint64_t percentile(double p);
+	uint64_t max();
+
+private:
+	std::vector<uint64_t> _samples;
+	int _next;
+	int _count;
+};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+
+#include <string.h>
+#include <errno.h>
+#include <alloca.h>
+#include <unistd.h>
+#include <err.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "RealTime.h"
+
+namespace PDEInkDriver {
+
+static bool locked_all = false;
+
+bool enterRealTime(int priority, int cpu, bool lockAll){
+	bool ok = true;
+
+	if(cpu >= 0){
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(0 != e){
+			errno = e;
+			warn("enterRealTime: cannot pin to CPU %d", cpu);
+		}
+	}
+
+	if(lockAll && !locked_all){
+		if(0 == mlockall(MCL_CURRENT | MCL_FUTURE)){
+			locked_all = true;
+		} else {
+			warn("enterRealTime: cannot lock memory");
+		}
+	}
+	prefaultStack();
+
+	int min = sched_get_priority_min(SCHED_FIFO);
+	int max = sched_get_priority_max(SCHED_FIFO);
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = (priority < min) ? min : (priority > max) ? max : priority;
+	int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if(0 != e){
+		errno = e;
+		warn("enterRealTime: cannot switch to SCHED_FIFO");
+		ok = false;
+	}
+	return ok;
+}
+
+void leaveRealTime(){
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+	if(locked_all){
+		munlockall();
+		locked_all = false;
+	}
+}
+
+void prefaultStack(size_t bytes){
+	unsigned char* stack = (unsigned char*)alloca(bytes);
+	// volatile so the stores are not optimised away
+	volatile unsigned char* p = stack;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i;
+	for(i = 0; i < bytes; i += page){
+		p[i] = 0;
+	}
+	if(bytes > 0){
+		p[bytes - 1] = 0;
+	}
+}
+
+}
@@ -0,0 +1,33 @@
+
+#ifndef REAL_TIME_H
+#define REAL_TIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DEFAULT_RT_PRIORITY 50
+#define DEFAULT_RT_STACK_PREFAULT (64 * 1024)
+
+namespace PDEInkDriver {
+
+// Run the calling thread, the one driving the panels, with SCHED_FIFO at
+// the given priority so BUSY polling and packet timing are not at the
+// mercy of other work on the core. cpu pins it to one CPU, negative
+// leaves the affinity alone. lockAll locks every page of the process,
+// present and future, into memory; without it lock the buffers of each
+// panel with EInk44::lockMemory(). The stack is prefaulted either way.
+// Needs CAP_SYS_NICE or an rtprio limit; returns false if the scheduler
+// refused, with whatever else succeeded left in place.
+bool enterRealTime(int priority = DEFAULT_RT_PRIORITY, int cpu = -1, bool lockAll = false);
+
+// back to SCHED_OTHER, memory locked by enterRealTime() is unlocked
+void leaveRealTime();
+
+// touch this many bytes of stack below the caller, so later calls do not
+// fault the pages in
+void prefaultStack(size_t bytes = DEFAULT_RT_STACK_PREFAULT);
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+
+#include "RetryPolicy.h"
+
+namespace PDEInkDriver {
+
+RetryPolicy::RetryPolicy(int attempts, int backoff, int maxBackoff, int resumes){
+	setAttempts(attempts);
+	setBackoff(backoff, maxBackoff);
+	setResumes(resumes);
+}
+
+int RetryPolicy::attempts(){
+	return _attempts;
+}
+
+int RetryPolicy::backoff(){
+	return _backoff;
+}
+
+int RetryPolicy::maxBackoff(){
+	return _maxBackoff;
+}
+
+int RetryPolicy::resumes(){
+	return _resumes;
+}
+
+void RetryPolicy::setAttempts(int attempts){
+	_attempts = (attempts < 1) ? 1 : attempts;
+}
+
+void RetryPolicy::setBackoff(int backoff, int maxBackoff){
+	_backoff = (backoff < 0) ? 0 : backoff;
+	_maxBackoff = (maxBackoff < _backoff) ? _backoff : maxBackoff;
+}
+
+void RetryPolicy::setResumes(int resumes){
+	_resumes = (resumes < 0) ? 0 : resumes;
+}
+
+int RetryPolicy::delay(int attempt){
+	int d = _backoff;
+	while(attempt-- > 0 && d < _maxBackoff){
+		d *= 2;
+	}
+	return (d > _maxBackoff) ? _maxBackoff : d;
+}
+
+bool RetryPolicy::retry(int attempt, Clock* clock){
+	if(attempt + 1 >= _attempts){
+		return false;
+	}
+	int d = delay(attempt);
+	if(d > 0){
+		clock->sleep(d);
+	}
+	return true;
+}
+
+}
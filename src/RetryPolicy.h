@@ -0,0 +1,53 @@
+
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "Clock.h"
+
+#define DEFAULT_RETRY_ATTEMPTS 4
+#define DEFAULT_RETRY_BACKOFF 1000
+#define DEFAULT_RETRY_MAX_BACKOFF 16000
+#define DEFAULT_RETRY_RESUMES 1
+
+namespace PDEInkDriver {
+
+// Bounded retry with exponential backoff. Every controller command that can
+// be answered with an error status goes through one instance of this, so the
+// number of attempts and the delay between them are configured in one place.
+class RetryPolicy {
+
+public:
+	RetryPolicy(int attempts = DEFAULT_RETRY_ATTEMPTS, int backoff = DEFAULT_RETRY_BACKOFF, int maxBackoff = DEFAULT_RETRY_MAX_BACKOFF, int resumes = DEFAULT_RETRY_RESUMES);
+
+	int attempts();
+	int backoff();
+	int maxBackoff();
+
+	// number of times an interrupted upload is resumed before giving up
+	int resumes();
+
+	void setAttempts(int attempts);
+	void setBackoff(int backoff, int maxBackoff);
+	void setResumes(int resumes);
+
+	// delay in microseconds before retrying after the given failed attempt (0 based)
+	int delay(int attempt);
+
+	// returns false if the failed attempt was the last one allowed,
+	// otherwise sleeps for the backoff delay on the clock and returns true
+	bool retry(int attempt, Clock* clock = Clock::monotonic());
+
+private:
+	int _attempts;
+	int _backoff;
+	int _maxBackoff;
+	int _resumes;
+};
+
+}
+
+#endif
@@ -0,0 +1,179 @@
+
+#include "ThreadPool.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace PDEInkDriver {
+
+struct ThreadPoolWorker {
+	ThreadPool* pool;
+	int index;
+};
+
+ThreadPool::ThreadPool(int workers){
+	if(workers < 0){
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = (cpus > 1) ? (int)cpus - 1 : 0;
+	}
+	_workers = workers;
+
+	// the caller of wait() uses the last queue
+	_queues = workers + 1;
+	_queue = new Queue[_queues];
+	int i;
+	for(i = 0; i < _queues; i++){
+		pthread_mutex_init(&_queue[i].lock, NULL);
+	}
+	_next = 0;
+
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_work, NULL);
+	pthread_cond_init(&_done, NULL);
+	_pending = 0;
+	_queued = 0;
+	_stop = false;
+
+	_threads = new pthread_t[(workers > 0) ? workers : 1];
+	for(i = 0; i < workers; i++){
+		ThreadPoolWorker* worker = new ThreadPoolWorker;
+		worker->pool = this;
+		worker->index = i;
+		if(0 != pthread_create(&_threads[i], NULL, _run, worker)){
+			delete worker;
+			_workers = i;
+			break;
+		}
+	}
+}
+
+ThreadPool::~ThreadPool(){
+	wait();
+
+	pthread_mutex_lock(&_lock);
+	_stop = true;
+	pthread_cond_broadcast(&_work);
+	pthread_mutex_unlock(&_lock);
+
+	int i;
+	for(i = 0; i < _workers; i++){
+		pthread_join(_threads[i], NULL);
+	}
+	delete[] _threads;
+
+	for(i = 0; i < _queues; i++){
+		pthread_mutex_destroy(&_queue[i].lock);
+	}
+	delete[] _queue;
+
+	pthread_cond_destroy(&_done);
+	pthread_cond_destroy(&_work);
+	pthread_mutex_destroy(&_lock);
+}
+
+ThreadPool* ThreadPool::shared(){
+	static ThreadPool pool;
+	return &pool;
+}
+
+int ThreadPool::workers(){
+	return _workers;
+}
+
+void ThreadPool::submit(ThreadPoolTask task, void* arg){
+	Job job;
+	job.task = task;
+	job.arg = arg;
+
+	pthread_mutex_lock(&_lock);
+	_pending++;
+	Queue& q = _queue[_next++ % _queues];
+	pthread_mutex_unlock(&_lock);
+
+	pthread_mutex_lock(&q.lock);
+	q.jobs.push_back(job);
+	pthread_mutex_unlock(&q.lock);
+
+	pthread_mutex_lock(&_lock);
+	_queued++;
+	pthread_cond_signal(&_work);
+	pthread_mutex_unlock(&_lock);
+}
+
+void ThreadPool::wait(){
+	Job job;
+	while(_take(_queues - 1, &job)){
+		job.task(job.arg);
+		_finish();
+	}
+
+	pthread_mutex_lock(&_lock);
+	while(_pending > 0){
+		pthread_cond_wait(&_done, &_lock);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+// Own queue from the back (most recently queued, still warm in cache),
+// other queues from the front
+bool ThreadPool::_take(int self, Job* job){
+	int i;
+	for(i = 0; i < _queues; i++){
+		Queue& q = _queue[(self + i) % _queues];
+		pthread_mutex_lock(&q.lock);
+		if(!q.jobs.empty()){
+			if(0 == i){
+				*job = q.jobs.back();
+				q.jobs.pop_back();
+			} else {
+				*job = q.jobs.front();
+				q.jobs.pop_front();
+			}
+			pthread_mutex_unlock(&q.lock);
+
+			pthread_mutex_lock(&_lock);
+			_queued--;
+			pthread_mutex_unlock(&_lock);
+			return true;
+		}
+		pthread_mutex_unlock(&q.lock);
+	}
+	return false;
+}
+
+void ThreadPool::_finish(){
+	pthread_mutex_lock(&_lock);
+	if(--_pending == 0){
+		pthread_cond_broadcast(&_done);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+void* ThreadPool::_run(void* arg){
+	ThreadPoolWorker* worker = (ThreadPoolWorker*)arg;
+	ThreadPool* pool = worker->pool;
+	int self = worker->index;
+	delete worker;
+
+	Job job;
+	for(;;){
+		if(pool->_take(self, &job)){
+			job.task(job.arg);
+			pool->_finish();
+			continue;
+		}
+
+		// sleep until more work is queued
+		pthread_mutex_lock(&pool->_lock);
+		while(!pool->_stop && pool->_queued <= 0){
+			pthread_cond_wait(&pool->_work, &pool->_lock);
+		}
+		bool stop = pool->_stop;
+		pthread_mutex_unlock(&pool->_lock);
+		if(stop){
+			return NULL;
+		}
+	}
+}
+
+}
@@ -0,0 +1,67 @@
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <deque>
+
+namespace PDEInkDriver {
+
+typedef void (*ThreadPoolTask)(void* arg);
+
+// Small work-stealing pool. Tasks are spread over per-worker queues; an
+// idle worker takes from the back of its own queue first and then steals
+// from the front of the others. The thread calling wait() works through
+// the queues as well, so a pool without workers simply runs everything
+// inline.
+class ThreadPool {
+
+public:
+	// workers < 0 uses one worker less than the number of online CPUs
+	ThreadPool(int workers = -1);
+	~ThreadPool();
+
+	int workers();
+
+	void submit(ThreadPoolTask task, void* arg);
+
+	// block until every submitted task has finished
+	void wait();
+
+	// process wide pool sized for the machine
+	static ThreadPool* shared();
+
+private:
+	struct Job {
+		ThreadPoolTask task;
+		void* arg;
+	};
+
+	struct Queue {
+		pthread_mutex_t lock;
+		std::deque<Job> jobs;
+	};
+
+	int _workers;
+	int _queues;
+	Queue* _queue;
+	pthread_t* _threads;
+	unsigned int _next;
+
+	pthread_mutex_t _lock;
+	pthread_cond_t _work;
+	pthread_cond_t _done;
+	int _pending;   // submitted and not finished
+	int _queued;    // submitted and not yet taken
+	bool _stop;
+
+	bool _take(int self, Job* job);
+	void _finish();
+	static void* _run(void* arg);
+};
+
+}
+
+#endif
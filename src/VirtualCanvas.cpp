@@ -0,0 +1,157 @@
+
+#include "VirtualCanvas.h"
+
+namespace PDEInkDriver {
+
+VirtualCanvas::VirtualCanvas(EInk44** panels, int columns, int rows, ThreadPool* pool) :
+	_image(columns * EINK_WIDTH, rows * EINK_HEIGHT){
+	_ownPool = (NULL == pool);
+	_pool = _ownPool ? new ThreadPool(columns * rows - 1) : pool;
+	_columns = columns;
+	_rows = rows;
+	_tiles = new Tile[columns * rows];
+
+	int i;
+	for(i = 0; i < columns * rows; i++){
+		Tile& t = _tiles[i];
+		t.canvas = this;
+		t.panel = panels[i];
+		t.column = i % columns;
+		t.row = i / columns;
+		t.x0 = t.y0 = t.x1 = t.y1 = 0;
+		t.ok = true;
+	}
+}
+
+VirtualCanvas::~VirtualCanvas(){
+	delete[] _tiles;
+	if(_ownPool){
+		delete _pool;
+	}
+}
+
+EInkImage& VirtualCanvas::image(){
+	return _image;
+}
+
+int VirtualCanvas::columns(){
+	return _columns;
+}
+
+int VirtualCanvas::rows(){
+	return _rows;
+}
+
+EInk44* VirtualCanvas::panel(int column, int row){
+	return _tiles[row * _columns + column].panel;
+}
+
+void VirtualCanvas::markDirty(int x, int y, int w, int h){
+	int x1 = x + w;
+	int y1 = y + h;
+	if(x < 0) x = 0;
+	if(y < 0) y = 0;
+	if(x1 > _image.width()) x1 = _image.width();
+	if(y1 > _image.height()) y1 = _image.height();
+	if(x >= x1 || y >= y1){
+		return;
+	}
+
+	// split the rectangle along panel edges and grow each panel's
+	// dirty area, widened to whole bytes since ROIs are byte packed
+	int c, r;
+	for(r = y / EINK_HEIGHT; r <= (y1 - 1) / EINK_HEIGHT; r++){
+		for(c = x / EINK_WIDTH; c <= (x1 - 1) / EINK_WIDTH; c++){
+			Tile& t = _tiles[r * _columns + c];
+			int tx0 = x - c * EINK_WIDTH;
+			int ty0 = y - r * EINK_HEIGHT;
+			int tx1 = x1 - c * EINK_WIDTH;
+			int ty1 = y1 - r * EINK_HEIGHT;
+			if(tx0 < 0) tx0 = 0;
+			if(ty0 < 0) ty0 = 0;
+			if(tx1 > EINK_WIDTH) tx1 = EINK_WIDTH;
+			if(ty1 > EINK_HEIGHT) ty1 = EINK_HEIGHT;
+			tx0 &= ~7;
+			tx1 = (tx1 + 7) & ~7;
+
+			if(t.x0 >= t.x1){
+				t.x0 = tx0; t.y0 = ty0; t.x1 = tx1; t.y1 = ty1;
+			} else {
+				if(tx0 < t.x0) t.x0 = tx0;
+				if(ty0 < t.y0) t.y0 = ty0;
+				if(tx1 > t.x1) t.x1 = tx1;
+				if(ty1 > t.y1) t.y1 = ty1;
+			}
+		}
+	}
+}
+
+void VirtualCanvas::markAll(){
+	markDirty(0, 0, _image.width(), _image.height());
+}
+
+bool VirtualCanvas::dirty(int column, int row, int* x, int* y, int* w, int* h){
+	Tile& t = _tiles[row * _columns + column];
+	if(t.x0 >= t.x1){
+		return false;
+	}
+	*x = t.x0;
+	*y = t.y0;
+	*w = t.x1 - t.x0;
+	*h = t.y1 - t.y0;
+	return true;
+}
+
+bool VirtualCanvas::commit(bool update, bool flashless){
+	int i;
+	int submitted = 0;
+	for(i = 0; i < _columns * _rows; i++){
+		Tile& t = _tiles[i];
+		t.ok = true;
+		if(t.x0 >= t.x1 || NULL == t.panel){
+			continue;
+		}
+		t.update = update;
+		t.flashless = flashless;
+		_pool->submit(_commitTile, &t);
+		submitted++;
+	}
+	if(submitted > 0){
+		_pool->wait();
+	}
+
+	bool ok = true;
+	for(i = 0; i < _columns * _rows; i++){
+		ok &= _tiles[i].ok;
+	}
+	return ok;
+}
+
+// Runs on a pool thread. Panels share the SPI bus, but each transaction
+// holds the bus only while it is on the wire, so one panel streams while
+// the others wait for BUSY.
+void VirtualCanvas::_commitTile(void* arg){
+	Tile& t = *(Tile*)arg;
+	VirtualCanvas* canvas = t.canvas;
+	int w = t.x1 - t.x0;
+	int h = t.y1 - t.y0;
+	int srcX = t.column * EINK_WIDTH + t.x0;
+	int srcY = t.row * EINK_HEIGHT + t.y0;
+
+	// the rows are streamed straight out of the shared image
+	EInkImage& image = canvas->_image;
+	t.panel->waitUntilFree();
+	t.ok = t.panel->sendImageROI(image.row(srcY) + srcX / 8, image.stride(), t.x0, t.y0, w, h);
+	if(t.ok){
+		t.x0 = t.y0 = t.x1 = t.y1 = 0;
+		if(t.update){
+			if(t.flashless){
+				t.panel->updateFlashless();
+			} else {
+				t.panel->update();
+			}
+		}
+	}
+}
+
+}
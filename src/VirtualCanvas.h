@@ -0,0 +1,64 @@
+
+#ifndef VIRTUAL_CANVAS_H
+#define VIRTUAL_CANVAS_H
+
+#include "EInk44.h"
+#include "EInkImage.h"
+#include "ThreadPool.h"
+
+namespace PDEInkDriver {
+
+// One large framebuffer laid over a grid of panels, row major: panel
+// (column, row) shows the EINK_WIDTH x EINK_HEIGHT tile whose top left
+// corner is at (column * EINK_WIDTH, row * EINK_HEIGHT). Draw into
+// image(), mark what changed, and commit() sends each affected panel
+// only its part of the dirty area, all panels at the same time.
+class VirtualCanvas {
+
+public:
+	// Uploads are bound by the bus and BUSY waits, not the CPU, so by
+	// default the canvas keeps its own pool with a thread per panel
+	VirtualCanvas(EInk44** panels, int columns, int rows, ThreadPool* pool = NULL);
+	~VirtualCanvas();
+
+	EInkImage& image();
+	int columns();
+	int rows();
+	EInk44* panel(int column, int row);
+
+	void markDirty(int x, int y, int w, int h);
+	void markAll();
+
+	// area of a panel waiting for the next commit, in panel pixels;
+	// false when there is none
+	bool dirty(int column, int row, int* x, int* y, int* w, int* h);
+
+	// upload the dirty regions and, if update is set, refresh the panels
+	// that received data; returns false if any panel failed
+	bool commit(bool update = true, bool flashless = true);
+
+private:
+	struct Tile {
+		VirtualCanvas* canvas;
+		EInk44* panel;
+		int column;
+		int row;
+		int x0, y0, x1, y1;   // dirty rectangle in panel pixels, empty if x0 >= x1
+		bool update;
+		bool flashless;
+		bool ok;
+	};
+
+	EInkImage _image;
+	ThreadPool* _pool;
+	bool _ownPool;
+	int _columns;
+	int _rows;
+	Tile* _tiles;
+
+	static void _commitTile(void* arg);
+};
+
+}
+
+#endif
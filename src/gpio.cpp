@@ -34,9 +34,12 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <err.h>
+#include <poll.h>
+#include <time.h>
 #include <map>
 
 #include "gpio.h"
+#include "gpio_chardev.h"
 
 namespace PDEInkDriver {
 namespace GPIO {
@@ -45,11 +48,32 @@ namespace GPIO {
 static char *slots = NULL;
 static char *ocp = NULL;
 
+// selected backend
+static GPIO_backend_type backend = GPIO_BACKEND_SYSFS;
+
+// pin levels of the virtual backend
+static std::map<int, int> virtual_levels;
+
+// AM335x GPIO banks, mapped by GPIO_map_registers()
+#define GPIO_BANKS 4
+#define GPIO_BANK_SIZE 0x1000
+#define GPIO_DATAIN 0x138
+static const off_t bank_base[GPIO_BANKS] = { 0x44E07000, 0x4804C000, 0x481AC000, 0x481AE000 };
+static volatile uint32_t *bank_regs[GPIO_BANKS];
+
 
 // GPIO
 
 #define MAKE_PIN(_name, _bank, _pin)   \
-	gpio_infos[GPIO_PIN(_bank, _pin)] = new GPIO_INFO(_name "\n");
+	{ GPIO_PIN(_bank, _pin), _name "\n" },
+
+// GPIO files
+#define SYS_CLASS_GPIO "/sys/class/gpio/gpio"
+#define STATE "state"
+#define DIRECTION "direction"
+#define ACTIVE_LOW "active_low"
+#define VALUE "value"
+#define EDGE "edge"
 
 // GPIO states / direction
 #define STATE_rxDisable_pullNone "rxDisable_pullNone"
@@ -62,6 +86,8 @@ static char *ocp = NULL;
 #define DIRECTION_in  "in"
 #define DIRECTION_out "out"
 
+#define EDGE_both "both"
+
 // PWM
 static struct {
 	char *name;
@@ -86,6 +112,7 @@ static void write_file(const char *file_name, const char *buffer, size_t length)
 static void export_pin(const char *pin_number);
 static void unexport(const char *pin_number);
 static bool GPIO_enable(int pin);
+static int sysfs_read(int pin);
 static bool PWM_enable(int channel, const char *pin_name);
 static void PWM_set_duty(int channel, int16_t value);
 
@@ -156,16 +183,11 @@ typedef std::map<int, GPIO_INFO*> gpio_info_t;
 typedef std::map<int, GPIO_INFO*>::iterator it_gpio_info;
 static gpio_info_t gpio_infos;
 
-GPIO_INFO* GPIO_get_info(int pin){
-	gpio_info_t::iterator i = gpio_infos.find(pin);
-	if(i == gpio_infos.end()){
-		gpio_infos[pin] = new GPIO_INFO();
-		return gpio_infos[pin];
-	}
-	return i->second;
-}
-
-void load_pins(){
+// firmware names, GPIO_INFO entries are only created for pins in use
+static const struct {
+	int pin;
+	const char *name;
+} pin_names[] = {
 	// Connector P8
 	MAKE_PIN("gpio-P8.03", 1, 6)   //  GPIO1_6
 	MAKE_PIN("gpio-P8.04", 1, 7)   //  GPIO1_7
@@ -234,13 +256,31 @@ void load_pins(){
 	MAKE_PIN("gpio-P9.29", 3, 15)  //  GPIO3_15  SPI1_D0
 	MAKE_PIN("gpio-P9.30", 3, 16)  //  GPIO3_16  SPI1_D1
 	MAKE_PIN("gpio-P9.31", 3, 14)  //  GPIO3_14  SPI1_SCLK
+};
+
+GPIO_INFO* GPIO_get_info(int pin){
+	gpio_info_t::iterator i = gpio_infos.find(pin);
+	if(i != gpio_infos.end()){
+		return i->second;
+	}
+
+	const char *name = "";
+	size_t n;
+	for (n = 0; n < SIZE_OF_ARRAY(pin_names); ++n) {
+		if (pin_names[n].pin == pin) {
+			name = pin_names[n].name;
+			break;
+		}
+	}
+	GPIO_INFO* info = new GPIO_INFO(name);
+	gpio_infos[pin] = info;
+	return info;
 }
 
 // set up access to the GPIO and PWM
 bool GPIO_setup() {
 
-	// Set up pin storage
-	load_pins();
+	backend = GPIO_BACKEND_SYSFS;
 
 	// ensure the base firmware is setup
 	if (load_firmware(NULL)) {
@@ -254,9 +294,42 @@ bool GPIO_setup() {
 }
 
 
+// set up access to the GPIO through /dev/gpiochipN
+bool GPIO_setup_chardev(const char *chip_pattern) {
+	GPIO_teardown();
+	if (!CHARDEV_setup(chip_pattern)) {
+		return false;
+	}
+	backend = GPIO_BACKEND_CHARDEV;
+	return true;
+}
+
+
+// set up pins that only exist in memory
+bool GPIO_setup_virtual() {
+	GPIO_teardown();
+	backend = GPIO_BACKEND_VIRTUAL;
+	return true;
+}
+
+
+GPIO_backend_type GPIO_backend() {
+	return backend;
+}
+
+
 /// revoke access to GPIO and PWM
 bool GPIO_teardown() {
 	size_t i;
+
+	CHARDEV_teardown();
+	virtual_levels.clear();
+	for (i = 0; i < GPIO_BANKS; ++i) {
+		if (NULL != bank_regs[i]) {
+			munmap((void *)bank_regs[i], GPIO_BANK_SIZE);
+			bank_regs[i] = NULL;
+		}
+	}
 	while (!gpio_infos.empty())
 	{
 		GPIO_INFO* info = gpio_infos.begin()->second;
@@ -292,6 +365,32 @@ bool GPIO_teardown() {
 }
 
 
+bool GPIO_map_registers() {
+	int fd = open("/dev/mem", O_RDWR | O_SYNC);
+	if (fd < 0) {
+		warn("GPIO: cannot open /dev/mem");
+		return false;
+	}
+
+	bool ok = true;
+	size_t i;
+	for (i = 0; i < GPIO_BANKS && ok; ++i) {
+		if (NULL != bank_regs[i]) {
+			continue;
+		}
+		void *map = mmap(NULL, GPIO_BANK_SIZE, PROT_READ, MAP_SHARED, fd, bank_base[i]);
+		if (MAP_FAILED == map) {
+			warn("GPIO: cannot map bank %d", (int)i);
+			ok = false;
+		} else {
+			bank_regs[i] = (volatile uint32_t *)map;
+		}
+	}
+	close(fd);
+	return ok;
+}
+
+
 void GPIO_mode(int pin, GPIO_mode_type mode) {
 
 	// ignore unimplemented pins
@@ -299,6 +398,16 @@ void GPIO_mode(int pin, GPIO_mode_type mode) {
 		return;
 	}
 
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		if (GPIO_PWM != mode) {
+			CHARDEV_request(&pin, &mode, 1);
+		}
+		return;
+	}
+	if (GPIO_BACKEND_VIRTUAL == backend) {
+		return;
+	}
+
 	GPIO_INFO* _gpio = GPIO_get_info(pin);
 
 	switch (mode) {
@@ -343,12 +452,47 @@ void GPIO_mode(int pin, GPIO_mode_type mode) {
 }
 
 
+bool GPIO_request(const int *pins, const GPIO_mode_type *modes, int count) {
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		return CHARDEV_request(pins, modes, count);
+	}
+	if (GPIO_BACKEND_VIRTUAL == backend) {
+		return true;
+	}
+
+	int i;
+	for (i = 0; i < count; ++i) {
+		GPIO_mode(pins[i], modes[i]);
+	}
+	return true;
+}
+
+
 int GPIO_read(int pin) {
 	// ignore unimplemented or inactive pins
 	if (pin < 0) { // {
 		return 0;
 	}
 
+	if (GPIO_BACKEND_VIRTUAL == backend) {
+		return virtual_levels[pin];
+	}
+
+	volatile uint32_t *regs = (pin / 32 < GPIO_BANKS) ? bank_regs[pin / 32] : NULL;
+	if (NULL != regs) {
+		return (regs[GPIO_DATAIN / 4] >> (pin & 0x1f)) & 1;
+	}
+
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		return CHARDEV_read(pin);
+	}
+
+	return sysfs_read(pin);
+}
+
+
+// read the value file from the start, which also rearms edge notification
+static int sysfs_read(int pin) {
 	GPIO_INFO* _gpio = GPIO_get_info(pin);
 	if(NULL == _gpio || NULL == _gpio->name || _gpio->fd < 0){
 		return 0;
@@ -375,6 +519,15 @@ void GPIO_write(int pin, int value) {
 		return;
 	}
 
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		CHARDEV_write(pin, value);
+		return;
+	}
+	if (GPIO_BACKEND_VIRTUAL == backend) {
+		virtual_levels[pin] = (0 != value);
+		return;
+	}
+
 	GPIO_INFO* _gpio = GPIO_get_info(pin);
 	if(NULL == _gpio || NULL == _gpio->name || _gpio->fd < 0){
 		return;
@@ -395,6 +548,94 @@ void GPIO_write(int pin, int value) {
 }
 
 
+void GPIO_write_many(const int *pins, const int *values, int count) {
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		CHARDEV_write_many(pins, values, count);
+		return;
+	}
+
+	int i;
+	for (i = 0; i < count; ++i) {
+		GPIO_write(pins[i], values[i]);
+	}
+}
+
+
+int GPIO_edge_fd(int pin, short *events) {
+	// ignore unimplemented or inactive pins
+	if (pin < 0) {
+		return -1;
+	}
+
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		return CHARDEV_edge_fd(pin, events);
+	}
+	if (GPIO_BACKEND_VIRTUAL == backend) {
+		return -1;
+	}
+
+	GPIO_INFO* _gpio = GPIO_get_info(pin);
+	if(NULL == _gpio || NULL == _gpio->number || _gpio->fd < 0){
+		return -1;
+	}
+
+	char edge[64];
+	snprintf(edge, sizeof(edge), SYS_CLASS_GPIO "%d/" EDGE, atoi(_gpio->number));
+	write_file(edge, EDGE_both "\n", CONST_STRLEN(EDGE_both "\n"));
+
+	// sysfs attributes are always readable, an edge is signalled as priority data
+	if (NULL != events) {
+		*events = POLLPRI | POLLERR;
+	}
+	return _gpio->fd;
+}
+
+
+int GPIO_edge_ack(int pin) {
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		return CHARDEV_edge_ack(pin);
+	}
+	if (GPIO_BACKEND_VIRTUAL == backend) {
+		return GPIO_read(pin);
+	}
+
+	// only reading the value file rearms the notification, so this must
+	// not take the register path of GPIO_read
+	if (pin < 0) {
+		return 0;
+	}
+	return sysfs_read(pin);
+}
+
+
+int GPIO_wait_edge(int pin, int timeout_us, uint64_t *timestamp_ns) {
+	if (GPIO_BACKEND_CHARDEV == backend) {
+		return CHARDEV_wait_edge(pin, timeout_us, timestamp_ns);
+	}
+
+	struct pollfd pfd;
+	pfd.fd = GPIO_edge_fd(pin, &pfd.events);
+	if (pfd.fd < 0) {
+		return -1;
+	}
+	GPIO_edge_ack(pin);  // discard an edge reported before the wait
+	pfd.revents = 0;
+	int result = poll(&pfd, 1, (timeout_us + 999) / 1000);
+	if (result <= 0) {
+		return result;
+	}
+	GPIO_edge_ack(pin);
+
+	// sysfs has no event time, use the wake up time
+	if (NULL != timestamp_ns) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		*timestamp_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+	return 1;
+}
+
+
 // only affetct PWM if correct pin is addressed
 void GPIO_pwm_write(int pin, uint32_t value) {
 	if (value > 1023) {
@@ -425,8 +666,12 @@ void GPIO_pwm_write(int pin, uint32_t value) {
 #include <ctype.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <limits.h>
 
 #define SYS_EXPORT   "/sys/class/gpio/export"
+
+// resolved pin paths, see cache_lookup()
+#define GPIO_CACHE "/run/pdeinkdriver-gpio.cache"
 #define SYS_UNEXPORT "/sys/class/gpio/unexport"
 
 #define SYS_DEVICES "/sys/devices"
@@ -435,13 +680,6 @@ void GPIO_pwm_write(int pin, uint32_t value) {
 
 #define SLOTS "/slots"
 
-// GPIO files
-#define SYS_CLASS_GPIO "/sys/class/gpio/gpio"
-#define STATE "state"
-#define DIRECTION "direction"
-#define ACTIVE_LOW "active_low"
-#define VALUE "value"
-
 
 // pwm files
 #define PERIOD "/period"
@@ -585,6 +823,142 @@ static void unexport(const char *pin_number) {
 }
 
 
+// allocate "<prefix><middle>/<file>", middle limited to middle_length characters
+static char *make_path(const char *prefix, const char *middle, size_t middle_length, const char *file) {
+	size_t length = strlen(prefix) + middle_length + sizeof((char)('/')) + strlen(file) + sizeof((char)('\0'));
+	char *path = (char*)malloc(length);
+	if (NULL == path) {
+		return NULL;
+	}
+	strcpy(path, prefix);
+	strncat(path, middle, middle_length);
+	strcat(path, "/");
+	strcat(path, file);
+	return path;
+}
+
+
+// look up the state path and GPIO number resolved for a pin by an
+// earlier run; the cache lives in /run so it is dropped on reboot
+// together with the loaded overlays
+static bool cache_lookup(const char *name, char *state, size_t state_size, char *number, size_t number_size) {
+	FILE *f = fopen(GPIO_CACHE, "r");
+	if (NULL == f) {
+		return false;
+	}
+
+	size_t length = strlen(name) - 1;  // ignore trailing '\n'
+	char line[512];
+	bool found = false;
+	while (!found && NULL != fgets(line, sizeof(line), f)) {
+		char *space = strchr(line, ' ');
+		if (NULL == space || (size_t)(space - line) != length || 0 != strncmp(line, name, length)) {
+			continue;
+		}
+		char *p = space + 1;
+		char *q = strchr(p, ' ');
+		if (NULL == q || (size_t)(q - p) >= state_size) {
+			continue;
+		}
+		memcpy(state, p, q - p);
+		state[q - p] = '\0';
+		size_t l = strspn(q + 1, "0123456789");
+		if (l <= 0 || l >= number_size) {
+			continue;
+		}
+		memcpy(number, q + 1, l);
+		number[l] = '\0';
+		found = true;
+	}
+	fclose(f);
+	return found;
+}
+
+
+static void cache_store(const char *name, const char *state, const char *number) {
+	FILE *f = fopen(GPIO_CACHE, "a");
+	if (NULL == f) {
+		return;  // cache is optional
+	}
+	fprintf(f, "%.*s %s %.*s\n", (int)(strlen(name) - 1), name, state,
+		(int)strspn(number, "0123456789"), number);
+	fclose(f);
+}
+
+
+// release everything GPIO_attach set up
+static void GPIO_release(GPIO_INFO *_gpio) {
+	if (_gpio->fd >= 0) {
+		close(_gpio->fd);
+		_gpio->fd = -1;
+	}
+	if (NULL != _gpio->state) {
+		free(_gpio->state);
+		_gpio->state = NULL;
+	}
+	if (NULL != _gpio->number) {
+		unexport(_gpio->number);
+		free(_gpio->number);
+		_gpio->number = NULL;
+	}
+	if (NULL != _gpio->direction) {
+		free(_gpio->direction);
+		_gpio->direction = NULL;
+	}
+	if (NULL != _gpio->active_low) {
+		free(_gpio->active_low);
+		_gpio->active_low = NULL;
+	}
+	if (NULL != _gpio->value) {
+		free(_gpio->value);
+		_gpio->value = NULL;
+	}
+}
+
+
+// fill in the sysfs files of a pin from its overlay state path and the
+// kernel GPIO number (first l characters of p), export it if needed and
+// open its value file
+static bool GPIO_attach(GPIO_INFO *_gpio, const char *state, const char *p, size_t l) {
+
+	// state - for setting optianl pullup/pulldown
+	_gpio->state = strdup(state);
+	if (NULL == _gpio->state) {
+		return false;  // failed
+	}
+
+	// save the GPIO number - the 'pin' variable probably has
+	// the same value, but it is safer to use the kernel provided value
+	// in case the kernel logic changes
+	_gpio->number = (char*)malloc(l + sizeof((char)('\n')) + sizeof((char)('\0')));
+	if (NULL == _gpio->number) {
+		return false;  // failed
+	}
+	strncpy(_gpio->number, p, l);
+	_gpio->number[l] = '\n';
+	_gpio->number[l + 1] = '\0';
+
+	_gpio->direction = make_path(SYS_CLASS_GPIO, p, l, DIRECTION);
+	_gpio->active_low = make_path(SYS_CLASS_GPIO, p, l, ACTIVE_LOW);
+	_gpio->value = make_path(SYS_CLASS_GPIO, p, l, VALUE);
+	if (NULL == _gpio->direction || NULL == _gpio->active_low || NULL == _gpio->value) {
+		return false;  // failed
+	}
+
+	// as the kernel to allocate the pin, unless a previous run left it exported
+	if (0 != access(_gpio->value, F_OK)) {
+		export_pin(_gpio->number);
+	}
+
+	// open a file handle to the value - to speed
+	// up access assumes most read/write go to
+	// this as other items (like direction) are
+	// only changed oocaisionally.
+	_gpio->fd = open(_gpio->value, O_RDWR | O_EXCL);
+	return _gpio->fd >= 0;
+}
+
+
 // enable GPIO
 static bool GPIO_enable(int pin) {
 	if (pin < 0){ // || pin >= SIZE_OF_ARRAY(gpio_info) || NULL == gpio_info[pin].name) {
@@ -597,6 +971,18 @@ static bool GPIO_enable(int pin) {
 		return true;  // already configured
 	}
 
+	// a pin resolved before needs no firmware load, settle delay or
+	// directory scan as long as its overlay is still present
+	char state[PATH_MAX];
+	char number[16];
+	if (cache_lookup(_gpio->name, state, sizeof(state), number, sizeof(number))
+	    && 0 == access(state, F_OK)) {
+		if (GPIO_attach(_gpio, state, number, strlen(number))) {
+			return true;
+		}
+		GPIO_release(_gpio);
+	}
+
 	// try to load its firmware
 	if (!load_firmware(_gpio->name)) {
 		return false;  // failed
@@ -617,22 +1003,7 @@ static bool GPIO_enable(int pin) {
 	while (NULL != (dp = readdir(dir))) {
 		if (0 == strncmp(dp->d_name, _gpio->name, length)) {
 
-			_gpio->state = (char*)malloc(strlen(ocp)
-						      + sizeof((char)('/'))
-						      + strlen(dp->d_name)
-						      + sizeof((char)('/'))
-						      + CONST_STRLEN(STATE)
-						      + sizeof((char)('\0')));
-			if (NULL == _gpio->state) {
-				break;  // failed
-			}
-
-			// state - for setting optianl pullup/pulldown
-			strcpy(_gpio->state, ocp);
-			strcat(_gpio->state, "/");
-			strcat(_gpio->state, dp->d_name);
-			strcat(_gpio->state, "/");
-			strcat(_gpio->state, STATE);
+			snprintf(state, sizeof(state), "%s/%s/" STATE, ocp, dp->d_name);
 
 			const char *p = &(dp->d_name[length]);
 			while ('\0' != *p && !isdigit(*p)) {
@@ -643,107 +1014,19 @@ static bool GPIO_enable(int pin) {
 				break;  // failed
 			}
 
-			// save the GPIO number - the 'pin' variable probably has
-			// the same value, but it is safer to use the kernel provided value
-			// in case the kernel logic changes
-			_gpio->number = (char*)malloc(l +  sizeof((char)('/')) + sizeof((char)('\0')));
-			if (NULL == _gpio->number) {
-				break;  // failed
-			}
-			strncpy(_gpio->number, p, l);
-			_gpio->number[l] = '\n';
-			_gpio->number[l + 1] = '\0';
-
-			// as the kernel to allocate the pin
-			export_pin(_gpio->number);
-
-			// the direction file name
-			_gpio->direction = (char*)malloc(CONST_STRLEN(SYS_CLASS_GPIO)
-							  + l
-							  + sizeof((char)('/'))
-							  + CONST_STRLEN(DIRECTION)
-							  + sizeof((char)('\0')));
-			if (NULL == _gpio->direction) {
-				break;  // failed
-			}
-
-			strcpy(_gpio->direction, SYS_CLASS_GPIO);
-			strncat(_gpio->direction, p, l);
-			strcat(_gpio->direction, "/");
-			strcat(_gpio->direction, DIRECTION);
-
-			// the active low file name
-			_gpio->active_low = (char*)malloc(CONST_STRLEN(SYS_CLASS_GPIO)
-							  + l
-							  + sizeof((char)('/'))
-							  + CONST_STRLEN(ACTIVE_LOW)
-							  + sizeof((char)('\0')));
-			if (NULL == _gpio->active_low) {
-				break;  // failed
-			}
-
-			strcpy(_gpio->active_low, SYS_CLASS_GPIO);
-			strncat(_gpio->active_low, p, l);
-			strcat(_gpio->active_low, "/");
-			strcat(_gpio->active_low, ACTIVE_LOW);
-
-			// the value file name
-			_gpio->value = (char*)malloc(CONST_STRLEN(SYS_CLASS_GPIO)
-						      + l
-						      + sizeof((char)('/'))
-						      + CONST_STRLEN(VALUE)
-						      + sizeof((char)('\0')));
-			if (NULL == _gpio->value) {
-				break;  // failed
-			}
-
-			strcpy(_gpio->value, SYS_CLASS_GPIO);
-			strncat(_gpio->value, p, l);
-			strcat(_gpio->value, "/");
-			strcat(_gpio->value, VALUE);
-
-			// open a file handle to the value - to speed
-			// up access assumes most read/write go to
-			// this as other items (like direction) are
-			// only changed oocaisionally.
-			_gpio->fd = open(_gpio->value, O_RDWR | O_EXCL);
-			if (_gpio->fd < 0) {
+			if (!GPIO_attach(_gpio, state, p, l)) {
 				break;  // failed
 			}
 
+			cache_store(_gpio->name, state, p);
+			closedir(dir);
 			return true;
-
-			break;
 		}
 	}
 	closedir(dir);
 
 	// clean up any allocated memory or descriptors
-	if (_gpio->fd >= 0) {
-		close(_gpio->fd);
-		_gpio->fd = -1;
-	}
-	if (NULL != _gpio->state) {
-		free(_gpio->state);
-		_gpio->state = NULL;
-	}
-	if (NULL != _gpio->number) {
-		unexport(_gpio->number);
-		free(_gpio->number);
-		_gpio->number = NULL;
-	}
-	if (NULL != _gpio->direction) {
-		free(_gpio->direction);
-		_gpio->direction = NULL;
-	}
-	if (NULL != _gpio->active_low) {
-		free(_gpio->active_low);
-		_gpio->active_low = NULL;
-	}
-	if (NULL != _gpio->value) {
-		free(_gpio->value);
-		_gpio->value = NULL;
-	}
+	GPIO_release(_gpio);
 
 	return false; // failed
 }
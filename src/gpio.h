@@ -136,6 +136,14 @@ typedef enum {
 } GPIO_mode_type;
 
 
+// GPIO backends
+typedef enum {
+	GPIO_BACKEND_SYSFS,   // cape manager overlays and /sys/class/gpio
+	GPIO_BACKEND_CHARDEV, // /dev/gpiochipN line requests
+	GPIO_BACKEND_VIRTUAL  // levels kept in memory, no hardware
+} GPIO_backend_type;
+
+
 // functions
 // =========
 
@@ -143,18 +151,59 @@ typedef enum {
 // return false if failure
 bool GPIO_setup();
 
+// enable GPIO system through the gpio character devices instead of sysfs,
+// chip_pattern is formatted with the bank number of each pin
+// return false if failure
+bool GPIO_setup_chardev(const char *chip_pattern = "/dev/gpiochip%d");
+
+// run without hardware: every pin holds the level last written to it,
+// inputs included, so tests can drive lines such as BUSY themselves and
+// pins never report edges
+// return false if failure
+bool GPIO_setup_virtual();
+
+// the backend selected by the last setup
+GPIO_backend_type GPIO_backend();
+
 // release mapped device registers
 bool GPIO_teardown();
 
+// map the AM335x GPIO bank registers through /dev/mem (needs root), so
+// GPIO_read of any input takes one load from GPIO_DATAIN instead of a
+// system call; call after setup, teardown unmaps them
+// return false if the registers cannot be mapped
+bool GPIO_map_registers();
+
 // set a mode for a given GPIO pin
 void GPIO_mode(int pin, GPIO_mode_type mode);
 
+// set the modes of several pins at once, with the chardev backend the pins
+// of each chip are held by a single line request
+// return false if any pin failed
+bool GPIO_request(const int *pins, const GPIO_mode_type *modes, int count);
+
 // return a value (0/1) for a given input pin
 int GPIO_read(int pin);
 
 // set or clear a given output pin
 void GPIO_write(int pin, int value);
 
+// set or clear several output pins, one ioctl per chip with chardev
+void GPIO_write_many(const int *pins, const int *values, int count);
+
+// enable edge detection on an input pin and return a descriptor that
+// becomes ready on every edge, with the poll(2) events to wait for
+// return -1 if the pin cannot report edges
+int GPIO_edge_fd(int pin, short *events);
+
+// clear a reported edge and return the current value (0/1)
+int GPIO_edge_ack(int pin);
+
+// wait up to timeout_us for an edge on an input pin, timestamp_ns receives
+// the kernel event time (chardev) or the wake up time (sysfs) on CLOCK_MONOTONIC
+// return 1 on an edge, 0 on timeout, -1 on failure
+int GPIO_wait_edge(int pin, int timeout_us, uint64_t *timestamp_ns);
+
 // set the PWM ration 0..1023 for hardware PWM pin (GPIO_P1_12)
 void GPIO_pwm_write(int pin, uint32_t value);
 
@@ -0,0 +1,354 @@
+// GPIO through the /dev/gpiochipN character devices (kernel 5.10+)
+//
+// Lines are requested with the v2 uAPI. All pins requested together that
+// live on the same chip share a single line handle, so they can be driven
+// with one ioctl and their edge events are read from one descriptor with
+// kernel timestamps. No cape manager, overlays or sysfs exports involved.
+//
+// On a development machine the gpio-sim module provides compatible chips:
+//   modprobe gpio-sim  (then configure banks through configfs)
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <map>
+
+#include "gpio_chardev.h"
+
+namespace PDEInkDriver {
+namespace GPIO {
+
+#define CHARDEV_CONSUMER "pdeinkdriver"
+#define CHARDEV_EVENT_BUFFER 16
+
+// bank and line of a pin, matches GPIO_PIN()
+#define PIN_BANK(pin) ((pin) / 32)
+#define PIN_LINE(pin) ((pin) & 0x1f)
+
+// one line request on a chip
+struct CHARDEV_HANDLE {
+	int fd;
+	int bank;
+	int count;
+	int pins[GPIO_V2_LINES_MAX];
+	GPIO_mode_type modes[GPIO_V2_LINES_MAX];
+};
+
+// where a requested pin lives
+struct CHARDEV_LINE {
+	CHARDEV_HANDLE *handle;
+	int index;
+};
+
+typedef std::map<int, CHARDEV_LINE> chardev_line_t;
+static chardev_line_t lines;
+static char *pattern = NULL;
+
+
+static CHARDEV_LINE *find_line(int pin) {
+	chardev_line_t::iterator i = lines.find(pin);
+	if (i == lines.end()) {
+		return NULL;
+	}
+	return &i->second;
+}
+
+
+// build the line configuration: inputs report both edges,
+// outputs are overridden per line through one flags attribute
+static void make_config(CHARDEV_HANDLE *handle, struct gpio_v2_line_config *config) {
+	memset(config, 0, sizeof(*config));
+	config->flags = GPIO_V2_LINE_FLAG_INPUT
+		| GPIO_V2_LINE_FLAG_EDGE_RISING
+		| GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+	uint64_t outputs = 0;
+	int i;
+	for (i = 0; i < handle->count; ++i) {
+		if (GPIO_OUTPUT == handle->modes[i]) {
+			outputs |= (uint64_t)1 << i;
+		}
+	}
+	if (0 != outputs) {
+		config->attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+		config->attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+		config->attrs[0].mask = outputs;
+		config->num_attrs = 1;
+	}
+}
+
+
+static bool open_handle(CHARDEV_HANDLE *handle) {
+	char path[64];
+	snprintf(path, sizeof(path), pattern, handle->bank);
+
+	int chip = open(path, O_RDWR | O_CLOEXEC);
+	if (chip < 0) {
+		warn("GPIO: cannot open %s", path);
+		return false;
+	}
+
+	struct gpio_v2_line_request request;
+	memset(&request, 0, sizeof(request));
+	int i;
+	for (i = 0; i < handle->count; ++i) {
+		request.offsets[i] = PIN_LINE(handle->pins[i]);
+	}
+	strncpy(request.consumer, CHARDEV_CONSUMER, sizeof(request.consumer) - 1);
+	make_config(handle, &request.config);
+	request.num_lines = handle->count;
+	request.event_buffer_size = CHARDEV_EVENT_BUFFER;
+
+	int result = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &request);
+	close(chip);
+	if (-1 == result) {
+		warn("GPIO: cannot request %d lines on %s", handle->count, path);
+		return false;
+	}
+
+	// events are drained without blocking, waits go through poll
+	fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+	handle->fd = request.fd;
+	return true;
+}
+
+
+bool CHARDEV_setup(const char *chip_pattern) {
+	CHARDEV_teardown();
+	pattern = strdup(chip_pattern);
+	return NULL != pattern;
+}
+
+
+bool CHARDEV_teardown() {
+	// several lines share a handle, close each one once
+	std::map<CHARDEV_HANDLE*, bool> handles;
+	chardev_line_t::iterator i;
+	for (i = lines.begin(); i != lines.end(); ++i) {
+		handles[i->second.handle] = true;
+	}
+	std::map<CHARDEV_HANDLE*, bool>::iterator h;
+	for (h = handles.begin(); h != handles.end(); ++h) {
+		close(h->first->fd);
+		delete h->first;
+	}
+	lines.clear();
+
+	if (NULL != pattern) {
+		free(pattern);
+		pattern = NULL;
+	}
+	return true;
+}
+
+
+bool CHARDEV_request(const int *pins, const GPIO_mode_type *modes, int count) {
+	if (NULL == pattern) {
+		return false;
+	}
+
+	bool ok = true;
+	bool done[GPIO_V2_LINES_MAX];
+	int i, j;
+	if (count > GPIO_V2_LINES_MAX) {
+		return false;
+	}
+	for (i = 0; i < count; ++i) {
+		done[i] = pins[i] < 0;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (done[i]) {
+			continue;
+		}
+
+		// a line that is already held only needs its direction changed,
+		// which means reconfiguring every line of its handle
+		CHARDEV_LINE *line = find_line(pins[i]);
+		if (NULL != line) {
+			done[i] = true;
+			CHARDEV_HANDLE *handle = line->handle;
+			if (handle->modes[line->index] != modes[i]) {
+				handle->modes[line->index] = modes[i];
+				struct gpio_v2_line_config config;
+				make_config(handle, &config);
+				if (-1 == ioctl(handle->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config)) {
+					warn("GPIO: cannot reconfigure pin %d", pins[i]);
+					ok = false;
+				}
+			}
+			continue;
+		}
+
+		// gather every new pin on the same bank into one request
+		CHARDEV_HANDLE *handle = new CHARDEV_HANDLE();
+		handle->fd = -1;
+		handle->bank = PIN_BANK(pins[i]);
+		handle->count = 0;
+		for (j = i; j < count; ++j) {
+			if (!done[j] && PIN_BANK(pins[j]) == handle->bank && NULL == find_line(pins[j])) {
+				handle->pins[handle->count] = pins[j];
+				handle->modes[handle->count] = modes[j];
+				handle->count++;
+				done[j] = true;
+			}
+		}
+
+		if (!open_handle(handle)) {
+			delete handle;
+			ok = false;
+			continue;
+		}
+
+		for (j = 0; j < handle->count; ++j) {
+			CHARDEV_LINE entry;
+			entry.handle = handle;
+			entry.index = j;
+			lines[handle->pins[j]] = entry;
+		}
+	}
+	return ok;
+}
+
+
+int CHARDEV_read(int pin) {
+	CHARDEV_LINE *line = find_line(pin);
+	if (NULL == line) {
+		return 0;
+	}
+
+	struct gpio_v2_line_values values;
+	values.bits = 0;
+	values.mask = (uint64_t)1 << line->index;
+	if (-1 == ioctl(line->handle->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values)) {
+		return 0;
+	}
+	return (values.bits & values.mask) ? 1 : 0;
+}
+
+
+void CHARDEV_write(int pin, int value) {
+	CHARDEV_write_many(&pin, &value, 1);
+}
+
+
+void CHARDEV_write_many(const int *pins, const int *values, int count) {
+	bool done[GPIO_V2_LINES_MAX];
+	int i, j;
+	if (count > GPIO_V2_LINES_MAX) {
+		return;
+	}
+	for (i = 0; i < count; ++i) {
+		done[i] = false;
+	}
+
+	// one ioctl per handle touched
+	for (i = 0; i < count; ++i) {
+		if (done[i]) {
+			continue;
+		}
+		CHARDEV_LINE *line = find_line(pins[i]);
+		if (NULL == line) {
+			done[i] = true;
+			continue;
+		}
+
+		CHARDEV_HANDLE *handle = line->handle;
+		struct gpio_v2_line_values v;
+		v.bits = 0;
+		v.mask = 0;
+		for (j = i; j < count; ++j) {
+			CHARDEV_LINE *other = done[j] ? NULL : find_line(pins[j]);
+			if (NULL != other && other->handle == handle) {
+				uint64_t bit = (uint64_t)1 << other->index;
+				v.mask |= bit;
+				if (0 != values[j]) {
+					v.bits |= bit;
+				}
+				done[j] = true;
+			}
+		}
+		ioctl(handle->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v);
+	}
+}
+
+
+int CHARDEV_edge_fd(int pin, short *events) {
+	CHARDEV_LINE *line = find_line(pin);
+	if (NULL == line || GPIO_INPUT != line->handle->modes[line->index]) {
+		return -1;
+	}
+	if (NULL != events) {
+		*events = POLLIN;
+	}
+	return line->handle->fd;
+}
+
+
+int CHARDEV_edge_ack(int pin) {
+	CHARDEV_LINE *line = find_line(pin);
+	if (NULL == line) {
+		return 0;
+	}
+
+	struct gpio_v2_line_event event[CHARDEV_EVENT_BUFFER];
+	while (read(line->handle->fd, event, sizeof(event)) > 0) {
+		// drain
+	}
+	return CHARDEV_read(pin);
+}
+
+
+int CHARDEV_wait_edge(int pin, int timeout_us, uint64_t *timestamp_ns) {
+	CHARDEV_LINE *line = find_line(pin);
+	if (NULL == line) {
+		return -1;
+	}
+
+	uint32_t offset = PIN_LINE(pin);
+	struct pollfd pfd;
+	pfd.fd = line->handle->fd;
+	pfd.events = POLLIN;
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (;;) {
+		struct gpio_v2_line_event event;
+		while (sizeof(event) == read(pfd.fd, &event, sizeof(event))) {
+			if (event.offset == offset) {
+				if (NULL != timestamp_ns) {
+					*timestamp_ns = event.timestamp_ns;
+				}
+				return 1;
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t elapsed = (int64_t)(now.tv_sec - start.tv_sec) * 1000000
+			+ (now.tv_nsec - start.tv_nsec) / 1000;
+		if (elapsed >= timeout_us) {
+			return 0;
+		}
+
+		pfd.revents = 0;
+		int ms = (timeout_us - elapsed + 999) / 1000;
+		if (poll(&pfd, 1, ms) < 0 && EINTR != errno) {
+			return -1;
+		}
+	}
+}
+
+}
+}
@@ -0,0 +1,30 @@
+// GPIO character device backend, used by gpio.cpp when set up with
+// GPIO_setup_chardev(). Not part of the public interface.
+
+#ifndef GPIO_CHARDEV_H
+#define GPIO_CHARDEV_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gpio.h"
+
+namespace PDEInkDriver {
+namespace GPIO {
+
+bool CHARDEV_setup(const char *chip_pattern);
+bool CHARDEV_teardown();
+
+bool CHARDEV_request(const int *pins, const GPIO_mode_type *modes, int count);
+int CHARDEV_read(int pin);
+void CHARDEV_write(int pin, int value);
+void CHARDEV_write_many(const int *pins, const int *values, int count);
+
+int CHARDEV_edge_fd(int pin, short *events);
+int CHARDEV_edge_ack(int pin);
+int CHARDEV_wait_edge(int pin, int timeout_us, uint64_t *timestamp_ns);
+
+}
+}
+
+#endif
@@ -22,11 +22,92 @@
 #include <err.h>
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
+#include <string.h>
+#include <map>
+#include <string>
 
 #include "spi.h"
 
 namespace PDEInkDriver {
 
+// One per SPI controller, shared by all of its chip selects. A block split
+// over several messages keeps its chip select asserted only as long as no
+// other device's message comes in between, so the lock covers the bus.
+struct SPIBus {
+	pthread_mutex_t lock;
+};
+
+// One per spidev node, shared by every SPI object opened on it: the
+// settings last written to the device. spidev keeps the mode and speed
+// per device rather than per descriptor, so the shadow lives here.
+struct SPIDevice {
+	SPIBus *bus;
+	bool known;
+	uint8_t mode;
+	uint8_t bits;
+	uint8_t lsb_first;
+	uint32_t speed_hz;
+};
+
+static pthread_mutex_t buses_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, SPIBus*> buses;
+static std::map<std::string, SPIDevice*> devices;
+
+// /dev/spidevB.C is chip select C of controller B, other nodes are taken
+// to have a controller of their own
+static std::string bus_name(const char *spi_path) {
+	const char *name = strrchr(spi_path, '/');
+	name = (NULL == name) ? spi_path : name + 1;
+	int bus, cs;
+	char key[32];
+	if (2 == sscanf(name, "spidev%d.%d", &bus, &cs)) {
+		snprintf(key, sizeof(key), "spidev%d", bus);
+		return key;
+	}
+	return spi_path;
+}
+
+static SPIDevice *device_for(const char *spi_path) {
+	pthread_mutex_lock(&buses_lock);
+	SPIDevice *device = devices[spi_path];
+	if (NULL == device) {
+		std::string name = bus_name(spi_path);
+		SPIBus *bus = buses[name];
+		if (NULL == bus) {
+			bus = new SPIBus;
+			pthread_mutex_init(&bus->lock, NULL);
+			buses[name] = bus;
+		}
+		device = new SPIDevice;
+		device->bus = bus;
+		device->known = false;
+		devices[spi_path] = device;
+	}
+	pthread_mutex_unlock(&buses_lock);
+	return device;
+}
+
+// spidev refuses messages larger than its bufsiz module parameter
+#define SPIDEV_BUFSIZ_PATH "/sys/module/spidev/parameters/bufsiz"
+#define SPIDEV_DEFAULT_BUFSIZ 4096
+
+static size_t read_bufsiz() {
+	unsigned long limit = 0;
+	FILE *f = fopen(SPIDEV_BUFSIZ_PATH, "r");
+	if (NULL != f) {
+		if (1 != fscanf(f, "%lu", &limit)) {
+			limit = 0;
+		}
+		fclose(f);
+	}
+	return (0 == limit) ? SPIDEV_DEFAULT_BUFSIZ : (size_t)limit;
+}
+
+size_t SPI::maxTransfer() {
+	static size_t limit = read_bufsiz();
+	return limit;
+}
+
 // prototypes
 SPI::SPI(const char *spi_path, uint32_t bps, GPIO::GPIO_pin_type cs_pin) {
 	_SPI(spi_path, bps, cs_pin);
@@ -47,16 +128,36 @@ void SPI::_SPI(const char* _spi_path, uint32_t _bps, GPIO::GPIO_pin_type _cs_pin
 	}
 
 	bps = _bps;
+	device = device_for(_spi_path);
+	bus = device->bus;
+
+	// whole pages, at least one, so a packet never straddles more pages
+	// than it has to on its way into the kernel
+	long page = sysconf(_SC_PAGESIZE);
+	if (page <= 0) {
+		page = 4096;
+	}
+	buffer_size = (maxTransfer() + page - 1) / page * page;
+	if (0 != posix_memalign((void **)&tx, page, buffer_size) ||
+	    0 != posix_memalign((void **)&rx, page, buffer_size)) {
+		err(1, "SPI: cannot allocate %lu byte transfer buffers", (unsigned long)buffer_size);
+	}
+	memset(tx, 0, buffer_size);
+	memset(rx, 0, buffer_size);
 
-	GPIO_mode(cs_pin, GPIO::GPIO_OUTPUT);
-	GPIO_write(cs_pin, (int)!cs_enable_high);
-	printf("[SPI] Opened %s with FD %d\n", _spi_path, fd);
+	if (!nativeCS()) {
+		GPIO_mode(cs_pin, GPIO::GPIO_OUTPUT);
+		GPIO_write(cs_pin, (int)!cs_enable_high);
+	}
+	printf("[SPI] Opened %s with FD %d%s\n", _spi_path, fd, nativeCS() ? " (native CS)" : "");
 }
 
 
 // release SPI fd (if open)
 SPI::~SPI() {
 	close(fd);
+	free(tx);
+	free(rx);
 }
 
 
@@ -65,10 +166,17 @@ SPI::~SPI() {
 void SPI::on(){
 	const uint8_t buffer[1] = {0};
 
+	// a device that never opened was reported then, there is no mode to set
+	if (fd < 0) {
+		return;
+	}
+
 	//set_spi_mode(SPI_MODE_2);
 	enable();
 	set_spi_mode(SPI_MODE_0);
 	send(buffer, sizeof(buffer));
+	// release CS so other devices on the bus are not addressed as well
+	disable();
 }
 
 
@@ -77,57 +185,42 @@ void SPI::on(){
 void SPI::off(){
 	const uint8_t buffer[1] = {0};
 
+	if (fd < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&bus->lock);
 	set_spi_mode(SPI_MODE_0);
 	send(buffer, sizeof(buffer));
-	disable();
+	select(false);
+	pthread_mutex_unlock(&bus->lock);
 }
 
 void SPI::enable(){
-	GPIO_write(cs_pin, (int)cs_enable_high);
+	pthread_mutex_lock(&bus->lock);
+	select(true);
 	// printf("[SPI] Enable\n");
 }
 
 void SPI::disable(){
-	GPIO_write(cs_pin, (int)!cs_enable_high);
+	select(false);
+	pthread_mutex_unlock(&bus->lock);
 	// printf("[SPI] Disable\n");
 }
 
 // send a data block to SPI
-// will only change CS if the SPI_CS bits are set
+// with native CS the block is one frame: CS is asserted for its length
+// and released after it, however many messages it takes
 void SPI::send(const void *buffer, size_t length) {
-	struct spi_ioc_transfer transfer_buffer[1] = {
-		{
-			.tx_buf = (unsigned long)(buffer),
-			.rx_buf = 0,  // nothing to receive
-			.len = length,
-			.speed_hz = bps,
-			.delay_usecs = 2,
-			.bits_per_word = 8,
-			.cs_change = 0
-		}
-	};
-
-	if (-1 == ioctl(fd, SPI_IOC_MESSAGE(1), transfer_buffer)) {
+	if (!transfer(buffer, NULL, length)) {
 		warn("SPI: send failure");
 	}
 }
 
 // send a data block to SPI and return last bytes returned by slave
-// will only change CS if the SPI_CS bits are set
+// framed like send()
 void SPI::read(const void *buffer, void *received, size_t length) {
-	struct spi_ioc_transfer transfer_buffer[1] = {
-		{
-			.tx_buf = (unsigned long)(buffer),
-			.rx_buf = (unsigned long)(received),
-			.len = length,
-			.speed_hz = bps,
-			.delay_usecs = 2,
-			.bits_per_word = 8,
-			.cs_change = 0
-		}
-	};
-
-	if (-1 == ioctl(fd, SPI_IOC_MESSAGE(1), transfer_buffer)) {
+	if (!transfer(buffer, received, length)) {
 		warn("SPI: read failure");
 	}
 }
@@ -136,29 +229,123 @@ void SPI::read(const void *buffer, void *received, size_t length) {
 // internal functions
 // ==================
 
+// Splits the block into the fewest messages spidev accepts, each one
+// transfer of up to maxTransfer() bytes. All but the last set cs_change,
+// which at the end of a message keeps a native CS asserted into the
+// next one, so the device sees a single frame either way.
+bool SPI::transfer(const void *buffer, void *received, size_t length) {
+	const unsigned char *out = (const unsigned char *)buffer;
+	unsigned char *in = (unsigned char *)received;
+	size_t limit = maxTransfer();
+	size_t done = 0;
+
+	do {
+		size_t n = length - done;
+		if (n > limit) {
+			n = limit;
+		}
+
+		struct spi_ioc_transfer t;
+		memset(&t, 0, sizeof(t));
+		t.tx_buf = (unsigned long)(out + done);
+		t.rx_buf = (NULL == in) ? 0 : (unsigned long)(in + done);
+		t.len = n;
+		t.speed_hz = bps;
+		t.delay_usecs = 2;
+		t.bits_per_word = 8;
+		t.cs_change = (done + n < length) ? 1 : 0;
+
+		if (-1 == ioctl(fd, SPI_IOC_MESSAGE(1), &t)) {
+			device->known = false;
+			return false;
+		}
+		done += n;
+	} while (done < length);
+
+	return true;
+}
+
+void SPI::select(bool selected) {
+	// the controller frames each message itself
+	if (nativeCS()) {
+		return;
+	}
+	GPIO_write(cs_pin, (int)(selected == cs_enable_high));
+}
+
+// Settings that already match the shadow of the bus are not written
+// again. Called with the bus held.
 void SPI::set_spi_mode(uint8_t in_mode) {
 
 	uint8_t mode = in_mode;
 	uint8_t bits = 8;
 	uint8_t lsb_first = 0;
 	uint32_t speed_hz = bps;
+	bool known = device->known;
+
+	// a failed write leaves the device in an unknown state
+	device->known = false;
 
 	// WR
-	if (-1 == ioctl(fd, SPI_IOC_WR_MODE, &mode)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_MODE  =%d", mode);
+	if (!known || mode != device->mode) {
+		if (-1 == ioctl(fd, SPI_IOC_WR_MODE, &mode)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_MODE  =%d", mode);
+		}
 	}
 
-	if (-1 == ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_BITS_PER_WORD = %d", bits);
+	if (!known || bits != device->bits) {
+		if (-1 == ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_BITS_PER_WORD = %d", bits);
+		}
 	}
 
-	if (-1 == ioctl(fd, SPI_IOC_WR_LSB_FIRST, &lsb_first)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_LSB_FIRST = %d", lsb_first);
+	if (!known || lsb_first != device->lsb_first) {
+		if (-1 == ioctl(fd, SPI_IOC_WR_LSB_FIRST, &lsb_first)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_LSB_FIRST = %d", lsb_first);
+		}
 	}
 
-	if (-1 == ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz)) {
-		err(1,"SPI: cannot set SPI_IOC_WR_MAX_SPEED_HZ = %d", speed_hz);
+	if (!known || speed_hz != device->speed_hz) {
+		if (-1 == ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz)) {
+			err(1,"SPI: cannot set SPI_IOC_WR_MAX_SPEED_HZ = %d", speed_hz);
+		}
 	}
+
+	device->mode = mode;
+	device->bits = bits;
+	device->lsb_first = lsb_first;
+	device->speed_hz = speed_hz;
+	device->known = true;
+}
+
+bool SPI::nativeCS() {
+	return cs_pin < 0;
+}
+
+void SPI::setSpeed(uint32_t _bps) {
+	bps = _bps;
+}
+
+uint32_t SPI::speed() {
+	return bps;
+}
+
+unsigned char *SPI::txBuffer() {
+	return tx;
+}
+
+unsigned char *SPI::rxBuffer() {
+	return rx;
+}
+
+size_t SPI::bufferSize() {
+	return buffer_size;
+}
+
+void SPI::invalidate() {
+	pthread_mutex_lock(&bus->lock);
+	device->known = false;
+	pthread_mutex_unlock(&bus->lock);
 }
 
 }
\ No newline at end of file
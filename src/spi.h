@@ -21,13 +21,23 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <pthread.h>
+
+// Chip select driven by the SPI controller itself rather than a GPIO
+#define SPI_NATIVE_CS ((GPIO::GPIO_pin_type)-1)
 
 namespace PDEInkDriver {
 
+struct SPIBus;
+struct SPIDevice;
+
 class SPI {
 
 public:
 	SPI(const char* spi_path, uint32_t bps);
+	// With SPI_NATIVE_CS (any negative pin) the controller frames every
+	// transfer with its own chip select line, the one the spidev node
+	// is bound to, and no GPIO is written around transfers
 	SPI(const char* spi_path, uint32_t bps, GPIO::GPIO_pin_type cs_pin);
 
 	~SPI();
@@ -35,20 +45,53 @@ public:
 	void on();
 	void off();
 
+	// select the device, holding the bus against other SPI objects on the
+	// same controller until disable(), so panels sharing a bus can be
+	// driven from different threads
 	void enable();
 	void disable();
 
+	// clock rate of the following transfers, other SPI objects on the
+	// same node keep their own
+	void setSpeed(uint32_t bps);
+	uint32_t speed();
+
+	// forget the device settings written so far, the next on() or off()
+	// writes all of them again
+	void invalidate();
+
+	bool nativeCS();
+
+	// Blocks of any length; longer ones than maxTransfer() go out as
+	// several messages without releasing the chip select in between
 	void send(const void *buffer, size_t length);
 	void read(const void *buffer, void *received, size_t length);
 
+	// largest message spidev accepts, its bufsiz parameter (4096 when
+	// it cannot be read)
+	static size_t maxTransfer();
+
+	// page aligned buffers owned by this object, bufferSize() bytes each,
+	// for building and receiving blocks without a copy of their own
+	unsigned char *txBuffer();
+	unsigned char *rxBuffer();
+	size_t bufferSize();
+
 private:
 	int fd;
 	uint32_t bps;
 	GPIO::GPIO_pin_type cs_pin;
 	bool cs_enable_high;
+	SPIBus *bus;
+	SPIDevice *device;
+	unsigned char *tx;
+	unsigned char *rx;
+	size_t buffer_size;
 
 	void _SPI(const char* spi_path, uint32_t bps, GPIO::GPIO_pin_type cs_pin);
 	void set_spi_mode(uint8_t mode);
+	void select(bool selected);
+	bool transfer(const void *buffer, void *received, size_t length);
 };
 
 }
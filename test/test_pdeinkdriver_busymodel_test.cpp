@@ -0,0 +1,61 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+int main(int argc, char* argv[])
+{
+	printf("Busy model test running...\n");
+
+	EInkBusyModel model;
+
+	// waits start out as they always were until a command is learned
+	assert(EINK_BUSY_LEARN_SLEEP == model.sleepTime(EINK_BUSY_PACKET));
+	assert(0 == model.spinTime(EINK_BUSY_PACKET));
+	assert(EINK_BUSY_LEARN_SLEEP == model.sleepTime(EINK_BUSY_OTHER));
+
+	// a steady command is learned and woken for just ahead of its end
+	int i;
+	for(i = 0; i < 200; i++){
+		model.note(EINK_BUSY_FILL, 3000 + (i & 1) * 20);
+	}
+	const EInkBusyModel::Estimate& fill = model.estimate(EINK_BUSY_FILL);
+	assert(fill.samples == 200);
+	assert(fill.expected >= 2990 && fill.expected <= 3030);
+	assert(fill.deviation <= 30);
+	uint64_t sleep = model.sleepTime(EINK_BUSY_FILL);
+	assert(sleep < 3000 && sleep > 2800);
+	assert(sleep + model.spinTime(EINK_BUSY_FILL) > 3020);
+
+	// the other commands are unaffected
+	assert(0 == model.estimate(EINK_BUSY_COPY).samples);
+
+	// A fast command measured through the learning sleep is first seen
+	// as slow. Once the sleeps shrink below it, waits measure the command
+	// again and the estimate follows it down.
+	for(i = 0; i < EINK_BUSY_LEARN_SAMPLES; i++){
+		model.note(EINK_BUSY_PACKET, EINK_BUSY_LEARN_SLEEP);
+	}
+	for(i = 0; i < 200; i++){
+		uint64_t s = model.sleepTime(EINK_BUSY_PACKET);
+		model.note(EINK_BUSY_PACKET, (s > 300) ? s : 300);
+	}
+	assert(model.estimate(EINK_BUSY_PACKET).expected < 400);
+	assert(model.sleepTime(EINK_BUSY_PACKET) >= EINK_BUSY_MIN_SLEEP);
+	assert(model.sleepTime(EINK_BUSY_PACKET) < 300);
+
+	// estimates can be carried over, e.g. from a state file
+	EInkBusyModel other;
+	other.setEstimate(EINK_BUSY_FILL, fill);
+	assert(other.sleepTime(EINK_BUSY_FILL) == sleep);
+
+	model.reset();
+	assert(EINK_BUSY_LEARN_SLEEP == model.sleepTime(EINK_BUSY_FILL));
+
+	printf("Busy model test passed\n");
+	return 0;
+}
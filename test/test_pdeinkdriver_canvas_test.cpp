@@ -0,0 +1,80 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+static bool is_dirty(VirtualCanvas& canvas, int c, int r, int x, int y, int w, int h){
+	int dx, dy, dw, dh;
+	if(!canvas.dirty(c, r, &dx, &dy, &dw, &dh)){
+		return false;
+	}
+	return dx == x && dy == y && dw == w && dh == h;
+}
+
+static bool is_clean(VirtualCanvas& canvas, int c, int r){
+	int dx, dy, dw, dh;
+	return !canvas.dirty(c, r, &dx, &dy, &dw, &dh);
+}
+
+int main(int argc, char* argv[])
+{
+	printf("Virtual canvas test running...\n");
+
+	// a 3x2 grid without panels, nothing is ever sent
+	EInk44* panels[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	ThreadPool pool(0);
+	VirtualCanvas canvas(panels, 3, 2, &pool);
+	assert(canvas.image().width() == 3 * EINK_WIDTH);
+	assert(canvas.image().height() == 2 * EINK_HEIGHT);
+	int c, r;
+	for(r = 0; r < 2; r++){
+		for(c = 0; c < 3; c++){
+			assert(is_clean(canvas, c, r));
+		}
+	}
+
+	// inside one panel, widened to whole bytes
+	canvas.markDirty(EINK_WIDTH + 13, 20, 10, 5);
+	assert(is_dirty(canvas, 1, 0, 8, 20, 16, 5));
+	assert(is_clean(canvas, 0, 0));
+	assert(is_clean(canvas, 2, 0));
+
+	// marks on the same panel grow its area to cover both
+	canvas.markDirty(EINK_WIDTH + 100, 2, 1, 1);
+	assert(is_dirty(canvas, 1, 0, 8, 2, 96, 23));
+
+	// across the corner of four panels, each gets its own part
+	canvas.markDirty(EINK_WIDTH * 2 - 12, EINK_HEIGHT - 3, 30, 10);
+	assert(is_dirty(canvas, 1, 0, 8, 2, EINK_WIDTH - 8, EINK_HEIGHT - 2));
+	assert(is_dirty(canvas, 2, 0, 0, EINK_HEIGHT - 3, 24, 3));
+	assert(is_dirty(canvas, 1, 1, EINK_WIDTH - 16, 0, 16, 7));
+	assert(is_dirty(canvas, 2, 1, 0, 0, 24, 7));
+	assert(is_clean(canvas, 0, 1));
+
+	// parts outside the canvas are dropped
+	canvas.markDirty(-50, -50, 60, 60);
+	assert(is_dirty(canvas, 0, 0, 0, 0, 16, 10));
+	canvas.markDirty(3 * EINK_WIDTH - 4, 2 * EINK_HEIGHT - 4, 100, 100);
+	assert(is_dirty(canvas, 2, 1, 0, 0, EINK_WIDTH, EINK_HEIGHT));
+
+	// empty marks leave everything as it was
+	canvas.markDirty(10, 10, 0, 10);
+	canvas.markDirty(3 * EINK_WIDTH, 0, 10, 10);
+	assert(is_clean(canvas, 0, 1));
+	assert(is_dirty(canvas, 0, 0, 0, 0, 16, 10));
+
+	// everything
+	canvas.markAll();
+	for(r = 0; r < 2; r++){
+		for(c = 0; c < 3; c++){
+			assert(is_dirty(canvas, c, r, 0, 0, EINK_WIDTH, EINK_HEIGHT));
+		}
+	}
+
+	printf("Virtual canvas test passed\n");
+	return 0;
+}
@@ -0,0 +1,57 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+
+int main(int argc, char* argv[]) 
+{
+	printf("Clock test running...\n");
+
+	PDEInkDriver::VirtualClock clock(1000);
+
+	// Deadlines only move with the clock
+	PDEInkDriver::Deadline deadline(&clock, MAX_UPDATE_TIMEOUT);
+	assert(!deadline.expired());
+	assert(deadline.remaining() == MAX_UPDATE_TIMEOUT);
+	clock.advance(MIN_UPDATE_TIMEOUT);
+	assert(deadline.elapsed() == MIN_UPDATE_TIMEOUT);
+	assert(!deadline.expired());
+	clock.sleep(MAX_UPDATE_TIMEOUT - MIN_UPDATE_TIMEOUT);
+	assert(deadline.expired());
+	assert(deadline.remaining() == 0);
+
+	PDEInkDriver::Deadline never;
+	assert(never.expired());
+
+	// only clocks that run by themselves can be spun and polled on
+	PDEInkDriver::MonotonicClock real;
+	assert(real.isReal());
+	assert(PDEInkDriver::Clock::monotonic()->isReal());
+	assert(!clock.isReal());
+
+	// Backoff doubles up to its limit and the attempts are bounded
+	PDEInkDriver::RetryPolicy policy(4, 1000, 3000);
+	assert(policy.delay(0) == 1000);
+	assert(policy.delay(1) == 2000);
+	assert(policy.delay(2) == 3000);
+	assert(policy.delay(10) == 3000);
+
+	uint64_t slept = clock.slept();
+	assert(policy.retry(0, &clock));
+	assert(policy.retry(1, &clock));
+	assert(policy.retry(2, &clock));
+	assert(!policy.retry(3, &clock));
+	assert(clock.slept() - slept == 1000 + 2000 + 3000);
+
+	// The real clock never goes backwards
+	PDEInkDriver::Clock* mono = PDEInkDriver::Clock::monotonic();
+	uint64_t before = mono->now();
+	mono->sleep(1000);
+	assert(mono->now() - before >= 1000);
+
+	printf("Clock test passed\n");
+	return 0;
+}
@@ -0,0 +1,99 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+static int count_white(EInkImage& img){
+	int white = 0;
+	int x, y;
+	for(y = 0; y < img.height(); y++){
+		for(x = 0; x < img.width(); x++){
+			int bit = (img.row(y)[x / 8] >> (7 - x % 8)) & 1;
+			#if EINK_INVERSE
+			white += bit;
+			#else
+			white += !bit;
+			#endif
+		}
+	}
+	return white;
+}
+
+static bool is_white(EInkImage& img, int x, int y){
+	int bit = (img.row(y)[x / 8] >> (7 - x % 8)) & 1;
+	#if EINK_INVERSE
+	return bit;
+	#else
+	return !bit;
+	#endif
+}
+
+int main(int argc, char* argv[]) 
+{
+	printf("Dither test running...\n");
+
+	const int w = 64, h = 64;
+	unsigned char grey[w * h];
+	EInkImage img(w, h);
+	EInkDitherMode modes[] = { DITHER_THRESHOLD, DITHER_BAYER, DITHER_FLOYD_STEINBERG, DITHER_ATKINSON };
+	int m;
+
+	for(m = 0; m < 4; m++){
+		EInkDitherer dither(modes[m]);
+
+		// black and white stay black and white
+		memset(grey, 0, sizeof(grey));
+		img.clear(true);
+		dither.dither(grey, w, h, w, img);
+		assert(count_white(img) == 0);
+
+		memset(grey, 255, sizeof(grey));
+		img.clear(false);
+		dither.dither(grey, w, h, w, img);
+		assert(count_white(img) == w * h);
+
+		// mid grey comes out as about half white
+		memset(grey, 128, sizeof(grey));
+		dither.dither(grey, w, h, w, img);
+		int white = count_white(img);
+		if(DITHER_THRESHOLD == modes[m]){
+			assert(white == w * h);
+		} else {
+			assert(abs(white - w * h / 2) < w * h / 16);
+		}
+	}
+
+	// the leftmost pixel is the most significant bit
+	EInkDitherer threshold(DITHER_THRESHOLD);
+	memset(grey, 0, sizeof(grey));
+	grey[0] = 255;
+	img.clear(false);
+	threshold.dither(grey, w, 1, w, img);
+	assert(is_white(img, 0, 0));
+	assert(!is_white(img, 1, 0));
+
+	// runs at odd offsets leave the pixels around them alone
+	memset(grey, 255, sizeof(grey));
+	img.clear(false);
+	threshold.dither(grey, 13, 2, w, img, 5, 3);
+	assert(count_white(img) == 13 * 2);
+	assert(!is_white(img, 4, 3));
+	assert(is_white(img, 5, 3));
+	assert(is_white(img, 17, 4));
+	assert(!is_white(img, 18, 4));
+
+	// and so does clipping at the image edges
+	img.clear(false);
+	threshold.dither(grey, 20, 4, w, img, -6, h - 2);
+	assert(count_white(img) == 14 * 2);
+	img.clear(false);
+	threshold.dither(grey, 20, 1, w, img, w - 5, 0);
+	assert(count_white(img) == 5);
+
+	printf("Dither test passed\n");
+	return 0;
+}
@@ -0,0 +1,61 @@
+
+#include <stdlib.h>
+#include <assert.h>
+#include <poll.h>
+#include <time.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+// Needs the board: BUSY is read through the GPIO registers and its edge
+// descriptor must still go quiet once an edge is acknowledged. Skipped
+// where the GPIO or the registers are not available.
+#define SKIP 77
+
+static uint64_t now_us(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char* argv[])
+{
+	printf("Edge test running...\n");
+
+	int busy = GPIO::GPIO_P9_25;
+	if (!GPIO::GPIO_setup()) {
+		warnx("GPIO_setup failed, skipped");
+		return SKIP;
+	}
+	GPIO::GPIO_mode(busy, GPIO::GPIO_INPUT);
+	if (!GPIO::GPIO_map_registers()) {
+		warnx("GPIO registers not available, skipped");
+		return SKIP;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = GPIO::GPIO_edge_fd(busy, &pfd.events);
+	if (pfd.fd < 0) {
+		warnx("BUSY cannot report edges, skipped");
+		return SKIP;
+	}
+
+	// a read through the registers leaves the descriptor alone, the
+	// acknowledgement clears it
+	GPIO::GPIO_read(busy);
+	GPIO::GPIO_edge_ack(busy);
+	pfd.revents = 0;
+	assert(0 == poll(&pfd, 1, 0));
+
+	// with the line idle a wait runs into its timeout instead of
+	// returning at once
+	uint64_t start = now_us();
+	assert(0 == GPIO::GPIO_wait_edge(busy, 50000, NULL));
+	assert(now_us() - start >= 40000);
+
+	GPIO::GPIO_teardown();
+	printf("Edge test passed\n");
+	return 0;
+}
@@ -0,0 +1,138 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+static const char bdf[] =
+	"STARTFONT 2.1\n"
+	"FONT -test-tiny\n"
+	"SIZE 8 75 75\n"
+	"FONTBOUNDINGBOX 11 8 0 -2\n"
+	"STARTPROPERTIES 2\n"
+	"FONT_ASCENT 6\n"
+	"FONT_DESCENT 2\n"
+	"ENDPROPERTIES\n"
+	"CHARS 4\n"
+	"STARTCHAR A\n"
+	"ENCODING 65\n"
+	"DWIDTH 6 0\n"
+	"BBX 5 6 0 0\n"
+	"BITMAP\n"
+	"20\n50\n88\nF8\n88\n88\n"
+	"ENDCHAR\n"
+	"STARTCHAR g\n"
+	"ENCODING 103\n"
+	"DWIDTH 5 0\n"
+	"BBX 4 5 0 -2\n"
+	"BITMAP\n"
+	"70\n90\n70\n10\nE0\n"
+	"ENDCHAR\n"
+	"STARTCHAR W\n"
+	"ENCODING 87\n"
+	"DWIDTH 12 0\n"
+	"BBX 11 2 0 0\n"
+	"BITMAP\n"
+	"FFE0\n8020\n"
+	"ENDCHAR\n"
+	"STARTCHAR Abreve\n"
+	"ENCODING 258\n"
+	"DWIDTH 6 0\n"
+	"BBX 5 1 0 0\n"
+	"BITMAP\n"
+	"F8\n"
+	"ENDCHAR\n"
+	"ENDFONT\n";
+
+// the same glyphs, rows from the top of the line
+struct Expected {
+	char c;
+	int advance;
+	int top;
+	const char* rows[6];
+};
+
+static const Expected glyphs[] = {
+	{ 'A', 6, 0, { "..#..", ".#.#.", "#...#", "#####", "#...#", "#...#" } },
+	{ 'g', 5, 3, { ".###", "#..#", ".###", "...#", "###.", NULL } },
+	{ 'W', 12, 4, { "###########", "#.........#", NULL, NULL, NULL, NULL } }
+};
+
+static bool is_white(EInkImage& img, int x, int y){
+	int bit = (img.row(y)[x / 8] >> (7 - x % 8)) & 1;
+	#if EINK_INVERSE
+	return bit;
+	#else
+	return !bit;
+	#endif
+}
+
+static const Expected* lookup(char c){
+	size_t i;
+	for(i = 0; i < sizeof(glyphs) / sizeof(glyphs[0]); i++){
+		if(glyphs[i].c == c){
+			return &glyphs[i];
+		}
+	}
+	return NULL;
+}
+
+// black text drawn at (x, y) on white, rows outside [top, bottom) untouched
+static void check(EInkImage& img, int x, int y, const char* text, int top, int bottom){
+	int px, py;
+	for(py = 0; py < img.height(); py++){
+		for(px = 0; px < img.width(); px++){
+			bool ink = false;
+			int pen = x;
+			const char* p;
+			for(p = text; *p; p++){
+				const Expected* g = lookup(*p);
+				int r = py - y - g->top;
+				int col = px - pen;
+				if(py >= top && py < bottom && r >= 0 && r < 6 && NULL != g->rows[r] &&
+						col >= 0 && col < (int)strlen(g->rows[r]) && '#' == g->rows[r][col]){
+					ink = true;
+				}
+				pen += g->advance;
+			}
+			assert(is_white(img, px, py) == !ink);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	printf("Font test running...\n");
+
+	EInkFont font;
+	assert(!font.loadBDF("STARTFONT 2.1\nENDFONT\n", 22));
+	assert(font.loadBDF(bdf, sizeof(bdf) - 1));
+
+	assert(font.ascent() == 6 && font.descent() == 2);
+	assert(font.top() == 0 && font.bottom() == 8);
+	assert(font.hasGlyph('A') && font.hasGlyph('g') && font.hasGlyph('W'));
+	assert(!font.hasGlyph('B'));
+	assert(font.textWidth("AgW") == 23);
+	assert(font.textWidth("ABA") == 12);
+
+	// aligned, unaligned, across byte edges and clipped on every side
+	EInkImage img(32, 12);
+	int places[][2] = { { 0, 0 }, { 5, 2 }, { 3, 4 }, { -3, -1 }, { 12, 6 } };
+	int i;
+	for(i = 0; i < 5; i++){
+		img.clear(true);
+		font.draw(img, places[i][0], places[i][1], "AgW");
+		check(img, places[i][0], places[i][1], "AgW", 0, img.height());
+	}
+
+	// limited to a band of rows
+	img.clear(true);
+	font.draw(img, 1, 1, "gAW", false, 3, 6);
+	check(img, 1, 1, "gAW", 3, 6);
+
+	printf("Font test passed\n");
+	return 0;
+}
@@ -0,0 +1,63 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+int main(int argc, char* argv[]) 
+{
+	printf("Frame store test running...\n");
+
+	char path[] = "/tmp/pdeinkdriver_frames_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	assert(EInkFrameStore::create(path, EINK_WIDTH, EINK_HEIGHT, 3));
+
+	// new frames are white and carry the panel header
+	EInkImage img(EINK_WIDTH, EINK_HEIGHT);
+	img.clear(true);
+
+	EInkFrameStore store;
+	assert(store.open(path, true));
+	assert(store.count() == 3);
+	assert(store.width() == EINK_WIDTH && store.height() == EINK_HEIGHT);
+	assert(store.frameLength() == img.length());
+	assert(0 == memcmp(store.frame(2), img.bits(), img.length()));
+	assert(NULL == store.frame(3));
+
+	// frames start on page boundaries
+	long page = sysconf(_SC_PAGESIZE);
+	assert(0 == ((uintptr_t)store.frame(0) % page));
+	assert(0 == ((uintptr_t)store.frame(1) % page));
+
+	img.fillRect(10, 20, 30, 40, false);
+	assert(store.store(1, img));
+	store.close();
+
+	// read only maps see what was stored and cannot be written
+	assert(store.open(path));
+	assert(0 == memcmp(store.frame(1), img.bits(), img.length()));
+	assert(!store.store(0, img));
+	store.prefetch(0);
+
+	EInkImage other(EINK_WIDTH / 2, EINK_HEIGHT);
+	assert(!store.store(0, other));
+	store.close();
+	assert(!store.isOpen());
+
+	// anything else is rejected
+	FILE* f = fopen(path, "r+b");
+	assert(NULL != f);
+	fputs("garbage!", f);
+	fclose(f);
+	assert(!store.open(path));
+
+	unlink(path);
+	printf("Frame store test passed\n");
+	return 0;
+}
@@ -0,0 +1,44 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+#define PRIME32 2654435761U
+#define PRIME64 11400714785074694797ULL
+
+int main(int argc, char* argv[])
+{
+	printf("Content hash test running...\n");
+
+	// the sanity check buffer of the xxHash reference implementation
+	unsigned char buffer[222];
+	uint64_t gen = PRIME32;
+	size_t i;
+	for(i = 0; i < sizeof(buffer); i++){
+		buffer[i] = (unsigned char)(gen >> 56);
+		gen *= PRIME64;
+	}
+
+	// its published XXH32 values, empty, short, and past one stripe
+	assert(0x02CC5D05 == contentHash(NULL, 0));
+	assert(0x36B78AE7 == contentHash(NULL, 0, PRIME32));
+	assert(0xCF65B03E == contentHash(buffer, 1));
+	assert(0xB4545AA4 == contentHash(buffer, 1, PRIME32));
+	assert(0x1208E7E2 == contentHash(buffer, 14));
+	assert(0x6AF1D1FE == contentHash(buffer, 14, PRIME32));
+	assert(0x5BD11DBD == contentHash(buffer, 222));
+	assert(0x58803C5F == contentHash(buffer, 222, PRIME32));
+	assert(0x32D153FF == contentHash("abc", 3));
+
+	// the result does not depend on the alignment of the data
+	unsigned char shifted[sizeof(buffer) + 3];
+	memcpy(shifted + 3, buffer, sizeof(buffer));
+	assert(0x5BD11DBD == contentHash(shifted + 3, 222));
+
+	printf("Content hash test passed\n");
+	return 0;
+}
@@ -0,0 +1,61 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+// Per-packet upload latency with and without real-time mode. Needs a panel
+// and, for the second run, CAP_SYS_NICE. Run the usual load next to it.
+//
+//   test_pdeinkdriver_jitter_bench [frames] [cpu]
+
+static void run(EInk44& eink, EInkImage** frames, int count, const char* label){
+	LatencyRecorder recorder;
+	eink.setLatencyRecorder(&recorder);
+	int i;
+	for(i = 0; i < count; i++){
+		eink.sendImage(*frames[i & 1]);
+	}
+	eink.setLatencyRecorder(NULL);
+
+	printf("%-10s %6d packets  p50 %6llu us  p99 %6llu us  p999 %6llu us  max %6llu us\n", label,
+		recorder.count(),
+		(unsigned long long)recorder.percentile(0.5),
+		(unsigned long long)recorder.percentile(0.99),
+		(unsigned long long)recorder.percentile(0.999),
+		(unsigned long long)recorder.max());
+}
+
+int main(int argc, char* argv[])
+{
+	int count = (argc > 1) ? atoi(argv[1]) : 50;
+	int cpu = (argc > 2) ? atoi(argv[2]) : -1;
+
+	if (!GPIO::GPIO_setup()) {
+		warn("GPIO_setup failed");
+		exit(2);
+	}
+
+	EInk44 eink;
+
+	// every frame goes out in full
+	eink.setDeduplication(false);
+	EInkImage white(EINK_WIDTH, EINK_HEIGHT);
+	EInkImage black(EINK_WIDTH, EINK_HEIGHT);
+	white.clear(true);
+	black.clear(false);
+	EInkImage* frames[2] = { &white, &black };
+
+	run(eink, frames, count, "normal");
+
+	if(!enterRealTime(DEFAULT_RT_PRIORITY, cpu)){
+		warnx("real-time mode not available, second run is not real-time");
+	}
+	eink.lockMemory();
+	run(eink, frames, count, "real-time");
+	leaveRealTime();
+	return 0;
+}
@@ -0,0 +1,45 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+int main(int argc, char* argv[])
+{
+	printf("Latency recorder test running...\n");
+
+	LatencyRecorder recorder(1000);
+	assert(0 == recorder.count());
+	assert(0 == recorder.percentile(0.5));
+
+	// 1..1000 in shuffled order
+	int i;
+	for(i = 0; i < 1000; i++){
+		recorder.record((i * 7919) % 1000 + 1);
+	}
+	assert(1000 == recorder.count());
+	assert(501 == recorder.percentile(0.5));
+	assert(991 == recorder.percentile(0.99));
+	assert(1000 == recorder.percentile(0.999));
+	assert(1000 == recorder.max());
+	assert(1 == recorder.percentile(0));
+
+	// only the newest samples are kept
+	for(i = 0; i < 1000; i++){
+		recorder.record(5);
+	}
+	assert(1000 == recorder.count());
+	assert(5 == recorder.max());
+
+	recorder.reset();
+	assert(0 == recorder.count());
+
+	// touching the stack needs no privileges
+	prefaultStack();
+
+	printf("Latency recorder test passed\n");
+	return 0;
+}
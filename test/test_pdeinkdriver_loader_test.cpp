@@ -0,0 +1,211 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef PDEINKDRIVER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+static bool is_white(EInkImage& img, int x, int y){
+	int bit = (img.row(y)[x / 8] >> (7 - x % 8)) & 1;
+	#if EINK_INVERSE
+	return bit;
+	#else
+	return !bit;
+	#endif
+}
+
+// checkerboard of 3x3 squares, white at the top left
+static bool expected(int x, int y){
+	return 0 == ((x / 3 + y / 3) & 1);
+}
+
+static void check(EInkImage& img, int w, int h, int ox, int oy){
+	int x, y;
+	for(y = 0; y < img.height(); y++){
+		for(x = 0; x < img.width(); x++){
+			int sx = x - ox, sy = y - oy;
+			bool inside = sx >= 0 && sy >= 0 && sx < w && sy < h;
+			// outside the picture the image stays black
+			assert(is_white(img, x, y) == (inside && expected(sx, sy)));
+		}
+	}
+}
+
+static void write_file(const char* path, const void* data, size_t length){
+	FILE* f = fopen(path, "wb");
+	assert(NULL != f);
+	assert(length == fwrite(data, 1, length, f));
+	fclose(f);
+}
+
+#ifdef PDEINKDRIVER_HAVE_ZLIB
+static void put_be32(std::vector<unsigned char>& out, uint32_t v){
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+static void put_chunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, uint32_t length){
+	put_be32(out, length);
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + length);
+	uLong crc = crc32(0, (const Bytef*)type, 4);
+	crc = crc32(crc, data, length);
+	put_be32(out, crc);
+}
+
+// 8 or 1 bit greyscale PNG of the checkerboard, cycling through the
+// filters, with the data for only the first rows when given
+static void write_png(const char* path, int w, int h, int rows = -1, int depth = 8){
+	int length = (8 == depth) ? w : (w + 7) / 8;
+	std::vector<unsigned char> raw;
+	std::vector<unsigned char> prev(length, 0);
+	int x, y;
+	for(y = 0; y < ((rows < 0) ? h : rows); y++){
+		int filter = y % 5;
+		raw.push_back(filter);
+		std::vector<unsigned char> line(length, 0);
+		for(x = 0; x < w; x++){
+			if(8 == depth){
+				line[x] = expected(x, y) ? 255 : 0;
+			} else if(expected(x, y)){
+				line[x / 8] |= 0x80 >> (x % 8);
+			}
+		}
+		for(x = 0; x < length; x++){
+			int left = (x > 0) ? line[x - 1] : 0;
+			int up = prev[x];
+			int upLeft = (x > 0) ? prev[x - 1] : 0;
+			int pred = 0;
+			if(1 == filter) pred = left;
+			if(2 == filter) pred = up;
+			if(3 == filter) pred = (left + up) >> 1;
+			if(4 == filter){
+				int p = left + up - upLeft;
+				int pa = abs(p - left), pb = abs(p - up), pc = abs(p - upLeft);
+				pred = (pa <= pb && pa <= pc) ? left : (pb <= pc) ? up : upLeft;
+			}
+			raw.push_back((unsigned char)(line[x] - pred));
+		}
+		prev = line;
+	}
+
+	uLongf size = compressBound(raw.size());
+	std::vector<unsigned char> z(size);
+	assert(Z_OK == compress(&z[0], &size, &raw[0], raw.size()));
+
+	unsigned char ihdr[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0 };
+	ihdr[8] = depth;
+	ihdr[2] = w >> 8; ihdr[3] = w;
+	ihdr[6] = h >> 8; ihdr[7] = h;
+
+	std::vector<unsigned char> png;
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	png.insert(png.end(), signature, signature + 8);
+	put_chunk(png, "IHDR", ihdr, sizeof(ihdr));
+	// split the data so decoding has to carry rows across chunks
+	put_chunk(png, "IDAT", &z[0], size / 2);
+	put_chunk(png, "IDAT", &z[size / 2], size - size / 2);
+	put_chunk(png, "IEND", NULL, 0);
+	write_file(path, &png[0], png.size());
+}
+#endif
+
+int main(int argc, char* argv[]) 
+{
+	printf("Loader test running...\n");
+
+	const int w = 21, h = 10;
+	char pbm[] = "/tmp/pdeinkdriver_loader_XXXXXX";
+	int fd = mkstemp(pbm);
+	assert(fd >= 0);
+	close(fd);
+
+	// raw PBM, 1 is black
+	std::vector<unsigned char> p4;
+	char header[32];
+	int n = snprintf(header, sizeof(header), "P4\n# test\n%d %d\n", w, h);
+	p4.insert(p4.end(), header, header + n);
+	int x, y;
+	for(y = 0; y < h; y++){
+		unsigned char row[3] = { 0, 0, 0 };
+		for(x = 0; x < w; x++){
+			if(!expected(x, y)){
+				row[x / 8] |= 0x80 >> (x % 8);
+			}
+		}
+		p4.insert(p4.end(), row, row + 3);
+	}
+	write_file(pbm, &p4[0], p4.size());
+
+	EInkImageLoader loader;
+	int iw, ih;
+	assert(loader.info(pbm, &iw, &ih));
+	assert(iw == w && ih == h);
+
+	EInkImage img(32, 16);
+	int offsets[][2] = { { 0, 0 }, { 3, 2 }, { 11, 5 }, { -5, -3 } };
+	int i;
+	for(i = 0; i < 4; i++){
+		img.clear(false);
+		assert(loader.load(pbm, img, offsets[i][0], offsets[i][1]));
+		check(img, w, h, offsets[i][0], offsets[i][1]);
+	}
+
+	// plain PBM of the same picture
+	std::string p1 = "P1\n21 10\n";
+	for(y = 0; y < h; y++){
+		for(x = 0; x < w; x++){
+			p1 += expected(x, y) ? "0 " : "1 ";
+		}
+		p1 += "\n";
+	}
+	write_file(pbm, p1.c_str(), p1.size());
+	img.clear(false);
+	assert(loader.load(pbm, img, 7, 1));
+	check(img, w, h, 7, 1);
+
+	EInkImage* loaded = loader.load(pbm);
+	assert(NULL != loaded);
+	assert(loaded->width() == 24 && loaded->height() == h);
+	delete loaded;
+
+#ifdef PDEINKDRIVER_HAVE_ZLIB
+	// pure black and white survives dithering untouched
+	write_png(pbm, w, h);
+	for(i = 0; i < 4; i++){
+		img.clear(false);
+		assert(loader.load(pbm, img, offsets[i][0], offsets[i][1]));
+		check(img, w, h, offsets[i][0], offsets[i][1]);
+	}
+
+	// 1 bit PNGs are copied straight in, at any bit offset
+	write_png(pbm, w, h, -1, 1);
+	for(i = 0; i < 4; i++){
+		img.clear(false);
+		assert(loader.load(pbm, img, offsets[i][0], offsets[i][1]));
+		check(img, w, h, offsets[i][0], offsets[i][1]);
+	}
+
+	// the data ends before the last row
+	write_png(pbm, w, h, h - 3);
+	img.clear(false);
+	assert(!loader.load(pbm, img, 0, 0));
+
+	// the RGB picture shipped with the tests
+	loaded = loader.load(PDEINKDRIVER_TEST_DIR "/pb.png");
+	assert(NULL != loaded);
+	assert(loaded->width() == 400 && loaded->height() == 203);
+	delete loaded;
+#endif
+
+	unlink(pbm);
+	printf("Loader test passed\n");
+	return 0;
+}
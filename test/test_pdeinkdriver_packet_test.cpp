@@ -0,0 +1,31 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+int main(int argc, char* argv[])
+{
+	printf("Packet test running...\n");
+
+	// packets carry whole rows
+	assert(EInk44::packetLength(EINK_WIDTH / 8) == 250);
+	assert(EInk44::packetLength(1) == MAX_PACKET_LENGTH);
+	assert(EInk44::packetLength(3) == 249);
+	assert(EInk44::packetLength(40) == 240);
+	assert(EInk44::packetLength(MAX_PACKET_LENGTH) == MAX_PACKET_LENGTH);
+
+	// rows longer than a packet are split over several
+	assert(EInk44::packetLength(MAX_PACKET_LENGTH + 1) == MAX_PACKET_LENGTH);
+	assert(EInk44::packetLength(1000) == MAX_PACKET_LENGTH);
+
+	// ROIs narrower than a byte have no rows to send
+	assert(EInk44::packetLength(0) == 0);
+	assert(EInk44::packetLength(-1) == 0);
+
+	printf("Packet test passed\n");
+	return 0;
+}
@@ -0,0 +1,102 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+int main(int argc, char* argv[]) 
+{
+	printf("Update policy test running...\n");
+
+	const int stride = EINK_WIDTH / 8;
+	static unsigned char frame[EINK_WIDTH / 8 * EINK_HEIGHT];
+	memset(frame, 0, sizeof(frame));
+
+	EInkUpdatePolicy policy;
+	policy.setBudget(0.5);
+	policy.setMaxPartialUpdates(3);
+	policy.setIdleRefreshDelay(1000);
+
+	// nothing on screen yet
+	assert(policy.ghosting() == 0);
+	assert(policy.pendingChange() == 0);
+
+	// a small change fits the budget with the fastest transition
+	memset(frame, 0xFF, stride * 10);
+	policy.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+	assert(policy.pendingChange() > 0);
+	assert(policy.choose() == EINK_UPDATE_FLASHLESS);
+	policy.noteUpdate(EINK_UPDATE_FLASHLESS, 0);
+	assert(policy.ghosting() > 0);
+	assert(policy.pendingChange() == 0);
+
+	// unchanged content adds nothing
+	policy.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+	assert(policy.pendingChange() == 0);
+
+	// repeated full changes of the same tiles run out of budget: first
+	// the cleaner flashless transition, then a full update
+	int i;
+	EInkTransition t = EINK_UPDATE_FLASHLESS;
+	for(i = 0; i < 10 && t != EINK_UPDATE_FULL; i++){
+		int r;
+		for(r = 0; r < 50; r++){
+			memset(frame + r * stride, (i & 1) ? 0xFF : 0x00, stride);
+		}
+		policy.noteUpload(0, 0, EINK_WIDTH, 50, frame, stride);
+		t = policy.choose();
+		policy.noteUpdate(t, 0);
+	}
+	assert(t == EINK_UPDATE_FULL);
+	assert(policy.ghosting() == 0);
+
+	// partial update counts are bounded even without ghosting
+	policy.setCost(EINK_UPDATE_FLASHLESS, 300000, 0.0);
+	for(i = 0; i < 3; i++){
+		frame[0] ^= 0x80;
+		policy.noteUpload(0, 0, 8, 1, frame, stride);
+		assert(policy.choose() == EINK_UPDATE_FLASHLESS);
+		policy.noteUpdate(EINK_UPDATE_FLASHLESS, 0);
+	}
+	frame[0] ^= 0x80;
+	policy.noteUpload(0, 0, 8, 1, frame, stride);
+	assert(policy.choose() == EINK_UPDATE_FULL);
+	policy.noteUpdate(EINK_UPDATE_FULL, 0);
+
+	// unknown content is treated as a full change
+	policy.setCost(EINK_UPDATE_FLASHLESS, 300000, 0.2);
+	policy.noteUnknown(100, 100, 8, 8);
+	assert(policy.choose() == EINK_UPDATE_FLASHLESS);
+	policy.noteUpdate(EINK_UPDATE_FLASHLESS, 5000);
+
+	// ghosting left behind is cleaned up once the panel is idle
+	assert(!policy.idleRefreshDue(5500));
+	assert(policy.idleRefreshDue(6000));
+	policy.noteUnknown(0, 0, 8, 8);
+	assert(!policy.idleRefreshDue(7000));
+	policy.noteUpdate(EINK_UPDATE_FULL, 7000);
+	assert(!policy.idleRefreshDue(9000));
+
+	// After a fill the shadow no longer matches the panel, so putting the
+	// old content back is a change until it has been written in full
+	memset(frame, 0, sizeof(frame));
+	policy.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+	policy.noteUpdate(EINK_UPDATE_FULL, 10000);
+	policy.noteUnknown(0, 0, EINK_WIDTH, EINK_HEIGHT);
+	policy.noteUpdate(EINK_UPDATE_FULL, 11000);
+	assert(policy.pendingChange() == 0);
+	policy.noteUpload(0, 0, 8, 1, frame, stride);
+	assert(policy.pendingChange() > 0);
+	policy.noteUpdate(EINK_UPDATE_FLASHLESS, 12000);
+	policy.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+	assert(policy.pendingChange() > 0);
+	policy.noteUpdate(EINK_UPDATE_FLASHLESS, 13000);
+	policy.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+	assert(policy.pendingChange() == 0);
+
+	printf("Update policy test passed\n");
+	return 0;
+}
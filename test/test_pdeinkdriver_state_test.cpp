@@ -0,0 +1,86 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+int main(int argc, char* argv[])
+{
+	printf("Panel state test running...\n");
+
+	char path[] = "/tmp/pdeinkdriver_state_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	// a new file holds nothing yet
+	EInkPanelState state;
+	assert(state.open(path, 64));
+	assert(state.length() == 64);
+	assert(!state.valid() && !state.current());
+
+	state.begin();
+	memset(state.data(), 0x5A, 64);
+	state.commit();
+	assert(state.valid() && state.current());
+	state.close();
+
+	// the payload survives reopening
+	assert(state.open(path, 64));
+	assert(state.valid());
+	assert(0x5A == state.data()[0] && 0x5A == state.data()[63]);
+
+	// a change left halfway is not trusted
+	state.begin();
+	state.data()[0] = 0;
+	state.close();
+	assert(state.open(path, 64));
+	assert(!state.valid());
+	state.begin();
+	state.commit();
+	assert(state.valid());
+	state.close();
+
+	// nor is a payload of another length
+	assert(state.open(path, 128));
+	assert(!state.valid());
+	assert(0 == state.data()[0]);
+	state.close();
+	unlink(path);
+
+	// the update policy comes back as it was saved
+	const int stride = EINK_WIDTH / 8;
+	static unsigned char frame[EINK_WIDTH / 8 * EINK_HEIGHT];
+	memset(frame, 0xFF, stride * 60);
+
+	EInkUpdatePolicy policy;
+	policy.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+	policy.noteUpdate(EINK_UPDATE_FLASHLESS, 1000);
+	memset(frame, 0x00, stride * 10);
+	policy.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+
+	unsigned char* saved = (unsigned char*)malloc(policy.stateLength());
+	policy.saveState(saved);
+
+	EInkUpdatePolicy restored;
+	assert(restored.restoreState(saved, policy.stateLength()));
+	assert(restored.ghosting() == policy.ghosting());
+	assert(restored.pendingChange() == policy.pendingChange());
+	assert(restored.choose() == policy.choose());
+
+	// the shadow came along: the same content again changes nothing more
+	double pending = restored.pendingChange();
+	restored.noteUpload(0, 0, EINK_WIDTH, EINK_HEIGHT, frame, stride);
+	assert(restored.pendingChange() == pending);
+
+	// another geometry does not fit
+	EInkUpdatePolicy other(EINK_WIDTH, EINK_HEIGHT, 25);
+	assert(!other.restoreState(saved, policy.stateLength()));
+	free(saved);
+
+	printf("Panel state test passed\n");
+	return 0;
+}
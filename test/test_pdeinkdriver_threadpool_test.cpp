@@ -0,0 +1,50 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+#define TASKS 2000
+
+static int runs[TASKS];
+
+static void count(void* arg){
+	__sync_fetch_and_add((int*)arg, 1);
+}
+
+static void check(ThreadPool& pool){
+	memset(runs, 0, sizeof(runs));
+	int i;
+	for(i = 0; i < TASKS; i++){
+		pool.submit(count, &runs[i]);
+	}
+	pool.wait();
+	for(i = 0; i < TASKS; i++){
+		assert(1 == runs[i]);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	printf("Thread pool test running...\n");
+
+	// every task runs exactly once, also when the pool is reused
+	ThreadPool pool(3);
+	assert(3 == pool.workers());
+	check(pool);
+	check(pool);
+
+	// without workers everything runs in wait()
+	ThreadPool inline_pool(0);
+	assert(0 == inline_pool.workers());
+	check(inline_pool);
+
+	// waiting on an idle pool returns at once
+	pool.wait();
+
+	printf("Thread pool test passed\n");
+	return 0;
+}
@@ -0,0 +1,65 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+static char logo_bits[24 * 12 / 8];
+
+int main(int argc, char* argv[])
+{
+	printf("Tiled canvas test running...\n");
+
+	int i;
+	for(i = 0; i < (int)sizeof(logo_bits); i++){
+		logo_bits[i] = (char)(i * 37 + 11);
+	}
+	XBMImage logo(logo_bits, 24, 12);
+
+	EInkImage serial(EINK_WIDTH, EINK_HEIGHT);
+	EInkImage tiled(EINK_WIDTH, EINK_HEIGHT);
+	ThreadPool pool(3);
+	EInkTiledCanvas canvas(tiled, &pool);
+	assert(canvas.bands() > 1);
+
+	// overlapping operations across band edges, unaligned and clipped,
+	// drawn in order give the same frame as drawing them one by one
+	serial.clear(true);
+	canvas.clear(true);
+	int rects[][5] = {
+		{ 0, 0, EINK_WIDTH, 7, 0 },
+		{ 3, 5, 101, 60, 0 },
+		{ 50, 30, 13, 200, 1 },
+		{ -20, -20, 45, 45, 0 },
+		{ EINK_WIDTH - 5, EINK_HEIGHT - 9, 40, 40, 0 },
+		{ 7, 1, 1, 1, 1 },
+		{ 0, 0, 0, 10, 0 }
+	};
+	for(i = 0; i < (int)(sizeof(rects) / sizeof(rects[0])); i++){
+		serial.fillRect(rects[i][0], rects[i][1], rects[i][2], rects[i][3], rects[i][4]);
+		canvas.fillRect(rects[i][0], rects[i][1], rects[i][2], rects[i][3], rects[i][4]);
+	}
+	int places[][2] = { { 0, 0 }, { 16, canvas.bandHeight() - 5 }, { 200, 90 }, { EINK_WIDTH - 16, EINK_HEIGHT - 4 } };
+	for(i = 0; i < 4; i++){
+		serial.addXBMImage(logo, places[i][0], places[i][1]);
+		canvas.addXBMImage(logo, places[i][0], places[i][1]);
+	}
+	serial.fillRect(10, 2, 30, 20, false);
+	canvas.fillRect(10, 2, 30, 20, false);
+
+	canvas.flush();
+	assert(0 == memcmp(serial.bits(), tiled.bits(), serial.length()));
+
+	// without a pool the bands are drawn on the calling thread
+	EInkTiledCanvas single(tiled, NULL);
+	serial.fillRect(60, 60, 77, 33, true);
+	single.fillRect(60, 60, 77, 33, true);
+	single.flush();
+	assert(0 == memcmp(serial.bits(), tiled.bits(), serial.length()));
+
+	printf("Tiled canvas test passed\n");
+	return 0;
+}
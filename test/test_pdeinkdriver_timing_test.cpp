@@ -0,0 +1,72 @@
+
+#include <stdlib.h>
+#include <assert.h>
+
+
+#include <pdeinkdriver.h>
+
+using namespace PDEInkDriver;
+
+// The update timing of a panel, fast-forwarded on a VirtualClock. BUSY
+// is driven by hand on the virtual GPIO backend and there is no SPI
+// device, so the commands themselves go nowhere.
+int main(int argc, char* argv[])
+{
+	printf("Timing test running...\n");
+
+	assert(GPIO::GPIO_setup_virtual());
+	GPIO::GPIO_write(BUSY_1, 1);
+
+	VirtualClock clock(1000);
+	EInk44 eink(EN_1, CS_1, BUSY_1, false, "/nonexistent/spidev");
+	eink.setClock(&clock);
+	assert(!eink.isBusy());
+
+	// an update counts as busy for its minimum time even with BUSY high
+	eink.update(true);
+	assert(eink.isBusy());
+	clock.advance(MIN_UPDATE_TIMEOUT - 1);
+	assert(eink.isBusy());
+	clock.advance(1);
+	assert(!eink.isBusy());
+
+	// with BUSY low it is given up on after the maximum time
+	eink.update(true);
+	GPIO::GPIO_write(BUSY_1, 0);
+	clock.advance(MIN_UPDATE_TIMEOUT);
+	assert(eink.isBusy());
+	clock.advance(MAX_UPDATE_TIMEOUT - MIN_UPDATE_TIMEOUT - 1);
+	assert(eink.isBusy());
+	clock.advance(1);
+	assert(!eink.isBusy());
+
+	// waiting sleeps through the minimum time and no further
+	GPIO::GPIO_write(BUSY_1, 1);
+	eink.update(true);
+	uint64_t start = clock.now();
+	eink.waitUntilFree();
+	assert(clock.now() - start >= MIN_UPDATE_TIMEOUT);
+	assert(clock.now() - start < MIN_UPDATE_TIMEOUT + EINK_BUSY_LEARN_SLEEP);
+	assert(0 == eink.health().timeouts);
+
+	// an update that never finishes is waited on for the maximum time,
+	// BUSY running out within it is no timeout
+	GPIO::GPIO_write(BUSY_1, 0);
+	eink.update(true);
+	start = clock.now();
+	eink.waitUntilFree();
+	assert(clock.now() - start >= MAX_UPDATE_TIMEOUT);
+	assert(clock.now() - start < MAX_UPDATE_TIMEOUT + EINK_BUSY_LEARN_SLEEP);
+	assert(0 == eink.health().timeouts);
+
+	// outside an update a BUSY wait times out and is counted
+	start = clock.now();
+	eink.waitUntilFree();
+	assert(clock.now() - start >= MAX_TIMEOUT);
+	assert(clock.now() - start < MAX_TIMEOUT + 2 * EINK_BUSY_LEARN_SLEEP);
+	assert(1 == eink.health().timeouts);
+
+	GPIO::GPIO_teardown();
+	printf("Timing test passed\n");
+	return 0;
+}